@@ -0,0 +1,254 @@
+#ifndef ARRAY_IO_H
+#define ARRAY_IO_H
+
+// Binary array files shared by the programs: a 64-byte header followed by a rows x cols
+// row-major array in native byte order (a vector is stored as n x 1). Every process reads
+// only its own block, either with a collective MPI-IO read (any file system, any number of
+// nodes) or by mapping the file (processes that see the file locally), so a load runs at the
+// aggregate file system bandwidth instead of funnelling through one process.
+
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define ARRAY_MAGIC "PARARRAY"
+#define ARRAY_VERSION 1
+#define ARRAY_HEADER_BYTES 64
+#define ARRAY_IO_CHUNK (1 << 30)        // Most bytes per MPI-IO call, keeps counts below INT_MAX
+
+enum { ARRAY_INT32 = 1, ARRAY_INT64 = 2, ARRAY_DOUBLE = 3 };
+enum { LOAD_MPIIO, LOAD_MMAP };
+
+// Header of a binary array file
+typedef struct {
+    char magic[8];          // ARRAY_MAGIC, not NUL-terminated
+    int32_t version;        // ARRAY_VERSION
+    int32_t type;           // ARRAY_INT32, ARRAY_INT64 or ARRAY_DOUBLE
+    int64_t rows, cols;     // Global array shape
+    char reserved[32];      // Pads the header to ARRAY_HEADER_BYTES
+} ArrayHeader;
+
+// Function to get the size in bytes of one element of an array type (0 if unknown)
+static inline int array_type_size(int type) {
+    switch (type) {
+    case ARRAY_INT32: return 4;
+    case ARRAY_INT64: return 8;
+    case ARRAY_DOUBLE: return 8;
+    default: return 0;
+    }
+}
+
+// Function to split n items into size blocks as evenly as possible: the first n % size
+// blocks get one extra item. Gives the first item and the count of block rank.
+static inline void block_partition(long long n, int size, int rank, long long *first, long long *count) {
+    long long base = n / size, extra = n % size;
+    *count = base + (rank < extra ? 1 : 0);
+    *first = base * rank + (rank < extra ? rank : extra);
+}
+
+// Function to fill in the header of an array file
+static inline void fill_array_header(ArrayHeader *header, int type, long long rows, long long cols) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, ARRAY_MAGIC, sizeof(header->magic));
+    header->version = ARRAY_VERSION;
+    header->type = type;
+    header->rows = rows;
+    header->cols = cols;
+}
+
+// Function to read and check the header of an array file on rank 0 and broadcast it
+// (collective). Returns 0 if the file is a valid array file on every process.
+static inline int read_array_header(const char *filename, ArrayHeader *header, MPI_Comm comm) {
+    int rank, status = 0;
+    MPI_Comm_rank(comm, &rank);
+
+    if (rank == 0) {
+        MPI_File fh;
+        MPI_Offset bytes = 0;
+        if (MPI_File_open(MPI_COMM_SELF, filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+            printf("Error opening %s\n", filename);
+            status = 1;
+        } else {
+            int err = MPI_File_read_at(fh, 0, header, ARRAY_HEADER_BYTES, MPI_BYTE, MPI_STATUS_IGNORE);
+            MPI_File_get_size(fh, &bytes);
+            MPI_File_close(&fh);
+            if (err != MPI_SUCCESS || memcmp(header->magic, ARRAY_MAGIC, sizeof(header->magic)) != 0 ||
+                header->version != ARRAY_VERSION || array_type_size(header->type) == 0 ||
+                header->rows < 0 || header->cols < 0) {
+                printf("%s is not an array file\n", filename);
+                status = 1;
+            } else if (bytes < ARRAY_HEADER_BYTES +
+                               (MPI_Offset)header->rows * header->cols * array_type_size(header->type)) {
+                printf("%s is truncated (%lld bytes for a %lld x %lld array)\n", filename,
+                       (long long)bytes, (long long)header->rows, (long long)header->cols);
+                status = 1;
+            }
+        }
+    }
+    MPI_Bcast(&status, 1, MPI_INT, 0, comm);
+    if (status == 0) MPI_Bcast(header, ARRAY_HEADER_BYTES, MPI_BYTE, 0, comm);
+    return status;
+}
+
+// Function to read bytes contiguous bytes at offset into buf with collective calls of at most
+// ARRAY_IO_CHUNK bytes; processes with fewer chunks join the remaining calls with no data
+static inline void read_contiguous(MPI_File fh, MPI_Offset offset, char *buf, long long bytes, MPI_Comm comm) {
+    long long rounds = (bytes + ARRAY_IO_CHUNK - 1) / ARRAY_IO_CHUNK;
+    MPI_Allreduce(MPI_IN_PLACE, &rounds, 1, MPI_LONG_LONG, MPI_MAX, comm);
+    for (long long r = 0; r < rounds; r++) {
+        long long done = r * ARRAY_IO_CHUNK;
+        long long part = bytes - done < ARRAY_IO_CHUNK ? bytes - done : ARRAY_IO_CHUNK;
+        if (part < 0) part = 0;
+        MPI_File_read_at_all(fh, offset + done, buf + (part > 0 ? done : 0), (int)part, MPI_BYTE,
+                             MPI_STATUS_IGNORE);
+    }
+}
+
+// Function to read the block [row0, row0 + rows) x [col0, col0 + cols) with collective MPI-IO.
+// Blocks of whole rows are one contiguous range; other blocks are described by a subarray
+// file view so that the library can merge the requests of all processes.
+static inline int load_block_mpiio(const char *filename, const ArrayHeader *h, long long row0, long long rows,
+                                   long long col0, long long cols, char *buf, MPI_Comm comm) {
+    MPI_File fh;
+    int es = array_type_size(h->type);
+    long long whole = cols == h->cols ? 1 : 0;
+
+    if (MPI_File_open(comm, filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) return 1;
+    // Every process has to take the same path through the collective calls
+    MPI_Allreduce(MPI_IN_PLACE, &whole, 1, MPI_LONG_LONG, MPI_MIN, comm);
+    if (whole) {
+        read_contiguous(fh, ARRAY_HEADER_BYTES + (MPI_Offset)row0 * h->cols * es, buf,
+                        rows * cols * es, comm);
+    } else {
+        MPI_Datatype element, filetype, row;
+        int sizes[2] = {(int)h->rows, (int)h->cols};
+        int subsizes[2] = {(int)rows, (int)cols};
+        int starts[2] = {(int)row0, (int)col0};
+        MPI_Type_contiguous(es, MPI_BYTE, &element);
+        MPI_Type_commit(&element);
+        MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, element, &filetype);
+        MPI_Type_commit(&filetype);
+        // Whole block rows as the memory type keep the count small
+        MPI_Type_contiguous((int)cols, element, &row);
+        MPI_Type_commit(&row);
+        MPI_File_set_view(fh, ARRAY_HEADER_BYTES, element, filetype, "native", MPI_INFO_NULL);
+        MPI_File_read_all(fh, buf, (int)rows, row, MPI_STATUS_IGNORE);
+        MPI_Type_free(&row);
+        MPI_Type_free(&filetype);
+        MPI_Type_free(&element);
+    }
+    MPI_File_close(&fh);
+    return 0;
+}
+
+// Function to read the same block by mapping the part of the file that holds it. The kernel
+// is told the range will be read once in order (and to start reading a block of whole rows
+// ahead), and the threads copy it out.
+static inline int load_block_mmap(const char *filename, const ArrayHeader *h, long long row0, long long rows,
+                                  long long col0, long long cols, char *buf) {
+    int es = array_type_size(h->type);
+    if (rows == 0 || cols == 0) return 0;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return 1;
+    long page = sysconf(_SC_PAGESIZE);
+    off_t begin = ARRAY_HEADER_BYTES + ((off_t)row0 * h->cols + col0) * es;
+    off_t end = ARRAY_HEADER_BYTES + ((off_t)(row0 + rows - 1) * h->cols + col0 + cols) * es;
+    off_t map_begin = begin / page * page;
+    size_t length = (size_t)(end - map_begin);
+
+    char *map = (char*)mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, map_begin);
+    close(fd);
+    if (map == MAP_FAILED) return 1;
+    madvise(map, length, MADV_SEQUENTIAL);
+    if (cols == h->cols) madvise(map, length, MADV_WILLNEED);
+
+    const char *src = map + (begin - map_begin);
+    size_t row_bytes = (size_t)cols * es, stride = (size_t)h->cols * es;
+    if (cols == h->cols) {
+        // One contiguous range, split evenly among the threads
+        size_t total = (size_t)rows * row_bytes;
+        #pragma omp parallel
+        {
+            int t = 0, nt = 1;
+#ifdef _OPENMP
+            t = omp_get_thread_num();
+            nt = omp_get_num_threads();
+#endif
+            size_t lo = total / nt * t, hi = t == nt - 1 ? total : total / nt * (t + 1);
+            memcpy(buf + lo, src + lo, hi - lo);
+        }
+    } else {
+        #pragma omp parallel for schedule(static)
+        for (long long i = 0; i < rows; i++)
+            memcpy(buf + (size_t)i * row_bytes, src + (size_t)i * stride, row_bytes);
+    }
+    munmap(map, length);
+    return 0;
+}
+
+// Function to read block [row0, row0 + rows) x [col0, col0 + cols) of an array file into buf
+// (collective; method is LOAD_MPIIO or LOAD_MMAP). Aborts if the file cannot be read.
+static inline void read_block(const char *filename, const ArrayHeader *h, long long row0, long long rows,
+                              long long col0, long long cols, void *buf, int method, MPI_Comm comm) {
+    int err;
+    if (method == LOAD_MMAP) err = load_block_mmap(filename, h, row0, rows, col0, cols, (char*)buf);
+    else err = load_block_mpiio(filename, h, row0, rows, col0, cols, (char*)buf, comm);
+    if (err != 0) {
+        fprintf(stderr, "Error reading %s\n", filename);
+        MPI_Abort(comm, 1);
+    }
+}
+
+// Function to read the same block into a new buffer
+static inline void *load_block(const char *filename, const ArrayHeader *h, long long row0, long long rows,
+                               long long col0, long long cols, int method, MPI_Comm comm) {
+    size_t bytes = (size_t)rows * cols * array_type_size(h->type);
+    void *buf = malloc(bytes > 0 ? bytes : 1);
+    if (buf == NULL) {
+        fprintf(stderr, "Memory allocation failed for a block of %s\n", filename);
+        MPI_Abort(comm, 1);
+    }
+    read_block(filename, h, row0, rows, col0, cols, buf, method, comm);
+    return buf;
+}
+
+// Function to write an array file from row blocks (collective): every process writes its rows
+// [row0, row0 + rows) with collective calls and rank 0 writes the header. Returns 0 on success.
+static inline int save_rows(const char *filename, const ArrayHeader *h, const void *data, long long row0,
+                            long long rows, MPI_Comm comm) {
+    MPI_File fh;
+    int rank, es = array_type_size(h->type);
+    MPI_Comm_rank(comm, &rank);
+
+    if (MPI_File_open(comm, filename, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+        if (rank == 0) printf("Error opening %s for writing\n", filename);
+        return 1;
+    }
+    MPI_File_set_size(fh, ARRAY_HEADER_BYTES + (MPI_Offset)h->rows * h->cols * es);
+    if (rank == 0) MPI_File_write_at(fh, 0, (void*)h, ARRAY_HEADER_BYTES, MPI_BYTE, MPI_STATUS_IGNORE);
+
+    long long bytes = rows * h->cols * es;
+    long long rounds = (bytes + ARRAY_IO_CHUNK - 1) / ARRAY_IO_CHUNK;
+    MPI_Offset offset = ARRAY_HEADER_BYTES + (MPI_Offset)row0 * h->cols * es;
+    MPI_Allreduce(MPI_IN_PLACE, &rounds, 1, MPI_LONG_LONG, MPI_MAX, comm);
+    for (long long r = 0; r < rounds; r++) {
+        long long done = r * ARRAY_IO_CHUNK;
+        long long part = bytes - done < ARRAY_IO_CHUNK ? bytes - done : ARRAY_IO_CHUNK;
+        if (part < 0) part = 0;
+        MPI_File_write_at_all(fh, offset + done, (const char*)data + (part > 0 ? done : 0), (int)part,
+                              MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+    MPI_File_close(&fh);
+    return 0;
+}
+
+#endif
@@ -1,54 +1,600 @@
 #include <mpi.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <time.h>
+#include <math.h>
+#include "philox.h"
+#include "array_io.h"
+#if defined(__AVX512F__) || (defined(__AVX2__) && defined(__FMA__))
+#include <immintrin.h>
+#endif
 
-#define N 70  // Matrix size
+#define N 70  // Default matrix size
+#define ALIGNMENT 64    // Byte alignment of matrices and packed buffers (one cache line)
 
-void multiply_matrix(int rows, double A[rows][N], double B[N][N], double C[rows][N]) {
-    for (int i = 0; i < rows; i++)
-        for (int j = 0; j < N; j++) {
-            C[i][j] = 0;
-            for (int k = 0; k < N; k++)
-                C[i][j] += A[i][k] * B[k][j];
+// Register tile of the micro-kernel: an MR x NR block of C stays in vector registers while a
+// packed sliver of A and one of B stream past it. The vector kernels hold six rows of two
+// vectors each.
+#if defined(__AVX512F__)
+#define MR 6
+#define NR 16
+#define VLEN 8
+typedef __m512d vec;
+#define VZERO() _mm512_setzero_pd()
+#define VLOAD(p) _mm512_load_pd(p)
+#define VLOADU(p) _mm512_loadu_pd(p)
+#define VSTOREU(p, v) _mm512_storeu_pd(p, v)
+#define VSET1(x) _mm512_set1_pd(x)
+#define VADD(a, b) _mm512_add_pd(a, b)
+#define VFMA(a, b, c) _mm512_fmadd_pd(a, b, c)
+#elif defined(__AVX2__) && defined(__FMA__)
+#define MR 6
+#define NR 8
+#define VLEN 4
+typedef __m256d vec;
+#define VZERO() _mm256_setzero_pd()
+#define VLOAD(p) _mm256_load_pd(p)
+#define VLOADU(p) _mm256_loadu_pd(p)
+#define VSTOREU(p, v) _mm256_storeu_pd(p, v)
+#define VSET1(x) _mm256_set1_pd(x)
+#define VADD(a, b) _mm256_add_pd(a, b)
+#define VFMA(a, b, c) _mm256_fmadd_pd(a, b, c)
+#else
+#define MR 4
+#define NR 4
+#endif
+
+// Cache blocking: a KC x NR sliver of B stays in L1, an MC x KC block of A in L2 and a
+// KC x NC panel of B in L3
+#define KC 256
+#define MC (MR * 16)
+#define NC 2048
+
+enum { SUMMA, CANNON };
+
+// 2D process grid and the local block of the distributed matrices
+typedef struct {
+    int n;                  // Global matrix size
+    int rank, size;
+    int dims[2], coords[2];
+    int row0, rows;         // Global rows of the local blocks
+    int col0, cols;         // Global columns of the local blocks
+    MPI_Comm comm;          // Cartesian communicator
+    MPI_Comm row_comm;      // Processes in the same process row
+    MPI_Comm col_comm;      // Processes in the same process column
+} Grid;
+
+// Packing buffers of the GEMM kernel, allocated once per run for the largest multiplication
+typedef struct {
+    double *Ap;             // MC x KC block of A in slivers of MR rows
+    double *Bp;             // KC x NC panel of B in slivers of NR columns
+} PackBuffers;
+
+// Function to allocate an aligned array of doubles
+double *alloc_matrix(size_t count) {
+    void *ptr = NULL;
+    if (count == 0) count = 1;
+    if (posix_memalign(&ptr, ALIGNMENT, count * sizeof(double)) != 0) {
+        fprintf(stderr, "Memory allocation failed\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    return (double*)ptr;
+}
+
+// Function to allocate the packing buffers for products of up to m x k times k x n
+void alloc_pack_buffers(PackBuffers *pack, int m, int n, int k) {
+    int kc_max = k < KC ? k : KC;
+    int nc_max = n < NC ? n : NC;
+    int mc_max = m < MC ? m : MC;
+    pack->Ap = alloc_matrix((size_t)(mc_max + MR) * kc_max);
+    pack->Bp = alloc_matrix((size_t)(nc_max + NR) * kc_max);
+}
+
+void free_pack_buffers(PackBuffers *pack) {
+    free(pack->Ap);
+    free(pack->Bp);
+}
+
+// Function to get the instruction set the micro-kernel was compiled for
+const char *kernel_isa(void) {
+#if defined(__AVX512F__)
+    return "AVX-512";
+#elif defined(__AVX2__) && defined(__FMA__)
+    return "AVX2+FMA";
+#else
+    return "scalar";
+#endif
+}
+
+// Function to pack an mc x kc block of A (row stride lda) into slivers of MR rows stored
+// column by column; the last sliver is padded with zeros
+void pack_a(int mc, int kc, const double *A, int lda, double *Ap) {
+    for (int i0 = 0; i0 < mc; i0 += MR) {
+        int rows = mc - i0 < MR ? mc - i0 : MR;
+        for (int k = 0; k < kc; k++) {
+            for (int i = 0; i < MR; i++) {
+                *Ap++ = i < rows ? A[(size_t)(i0 + i) * lda + k] : 0.0;
+            }
+        }
+    }
+}
+
+// Function to pack a kc x nc panel of B (row stride ldb) into slivers of NR columns stored
+// row by row; the last sliver is padded with zeros
+void pack_b(int kc, int nc, const double *B, int ldb, double *Bp) {
+    for (int j0 = 0; j0 < nc; j0 += NR) {
+        int cols = nc - j0 < NR ? nc - j0 : NR;
+        for (int k = 0; k < kc; k++) {
+            const double *row = B + (size_t)k * ldb + j0;
+            for (int j = 0; j < NR; j++) {
+                *Bp++ = j < cols ? row[j] : 0.0;
+            }
+        }
+    }
+}
+
+// Function to add the MR x NR product of a packed A sliver and a packed B sliver over kc
+// steps to C (row stride ldc)
+void micro_kernel(int kc, const double *Ap, const double *Bp, double *C, int ldc) {
+#ifdef VLEN
+    // Twelve accumulators: six rows of C, two vectors per row
+    vec c00 = VZERO(), c01 = VZERO(), c10 = VZERO(), c11 = VZERO();
+    vec c20 = VZERO(), c21 = VZERO(), c30 = VZERO(), c31 = VZERO();
+    vec c40 = VZERO(), c41 = VZERO(), c50 = VZERO(), c51 = VZERO();
+
+    for (int k = 0; k < kc; k++) {
+        vec b0 = VLOAD(Bp);
+        vec b1 = VLOAD(Bp + VLEN);
+        vec a;
+        a = VSET1(Ap[0]); c00 = VFMA(a, b0, c00); c01 = VFMA(a, b1, c01);
+        a = VSET1(Ap[1]); c10 = VFMA(a, b0, c10); c11 = VFMA(a, b1, c11);
+        a = VSET1(Ap[2]); c20 = VFMA(a, b0, c20); c21 = VFMA(a, b1, c21);
+        a = VSET1(Ap[3]); c30 = VFMA(a, b0, c30); c31 = VFMA(a, b1, c31);
+        a = VSET1(Ap[4]); c40 = VFMA(a, b0, c40); c41 = VFMA(a, b1, c41);
+        a = VSET1(Ap[5]); c50 = VFMA(a, b0, c50); c51 = VFMA(a, b1, c51);
+        Ap += MR;
+        Bp += NR;
+    }
+
+#define ADD_ROW(r0, r1) \
+    VSTOREU(C, VADD(VLOADU(C), r0)); VSTOREU(C + VLEN, VADD(VLOADU(C + VLEN), r1)); C += ldc
+    ADD_ROW(c00, c01);
+    ADD_ROW(c10, c11);
+    ADD_ROW(c20, c21);
+    ADD_ROW(c30, c31);
+    ADD_ROW(c40, c41);
+    ADD_ROW(c50, c51);
+#undef ADD_ROW
+#else
+    double c[MR][NR] = {{0.0}};
+
+    for (int k = 0; k < kc; k++) {
+        for (int i = 0; i < MR; i++)
+            for (int j = 0; j < NR; j++)
+                c[i][j] += Ap[i] * Bp[j];
+        Ap += MR;
+        Bp += NR;
+    }
+
+    for (int i = 0; i < MR; i++)
+        for (int j = 0; j < NR; j++)
+            C[(size_t)i * ldc + j] += c[i][j];
+#endif
+}
+
+// Function to add the packed product of an mc x kc block of A and a kc x nc panel of B to C,
+// one MR x NR register tile at a time; partial tiles on the edges go through a scratch tile
+void macro_kernel(int mc, int nc, int kc, const double *Ap, const double *Bp,
+                  double *C, int ldc) {
+    double tile[MR * NR];
+
+    for (int j0 = 0; j0 < nc; j0 += NR) {
+        int cols = nc - j0 < NR ? nc - j0 : NR;
+        for (int i0 = 0; i0 < mc; i0 += MR) {
+            int rows = mc - i0 < MR ? mc - i0 : MR;
+            double *c = C + (size_t)i0 * ldc + j0;
+
+            if (rows == MR && cols == NR) {
+                micro_kernel(kc, Ap + (size_t)i0 * kc, Bp + (size_t)j0 * kc, c, ldc);
+                continue;
+            }
+            memset(tile, 0, sizeof(tile));
+            micro_kernel(kc, Ap + (size_t)i0 * kc, Bp + (size_t)j0 * kc, tile, NR);
+            for (int i = 0; i < rows; i++)
+                for (int j = 0; j < cols; j++)
+                    c[(size_t)i * ldc + j] += tile[i * NR + j];
+        }
+    }
+}
+
+// Function to compute C += A B for an m x k matrix A and a k x n matrix B (row-major with
+// row strides lda, ldb and ldc). B is packed one KC x NC panel at a time and A one MC x KC
+// block at a time, so the micro-kernel only ever reads contiguous, cache-resident data. The
+// packing buffers must be allocated for at least m, n and k.
+void multiply_matrix(int m, int n, int k, const double *A, int lda, const double *B, int ldb,
+                     double *C, int ldc, const PackBuffers *pack) {
+    double *Ap = pack->Ap, *Bp = pack->Bp;
+
+    for (int j0 = 0; j0 < n; j0 += NC) {
+        int nc = n - j0 < NC ? n - j0 : NC;
+        for (int p0 = 0; p0 < k; p0 += KC) {
+            int kc = k - p0 < KC ? k - p0 : KC;
+            pack_b(kc, nc, B + (size_t)p0 * ldb + j0, ldb, Bp);
+            for (int i0 = 0; i0 < m; i0 += MC) {
+                int mc = m - i0 < MC ? m - i0 : MC;
+                pack_a(mc, kc, A + (size_t)i0 * lda + p0, lda, Ap);
+                macro_kernel(mc, nc, kc, Ap, Bp, C + (size_t)i0 * ldc + j0, ldc);
+            }
+        }
+    }
+}
+
+// Function to split n indices into p nearly equal blocks; block r gets [*start, *start + *count)
+void block_range(int n, int p, int r, int *start, int *count) {
+    int base = n / p;
+    int remainder = n % p;
+    *count = base + (r < remainder ? 1 : 0);
+    *start = r * base + (r < remainder ? r : remainder);
+}
+
+// Function to find the block of block_range(n, p, ...) that holds index k
+int block_owner(int n, int p, int k) {
+    int base = n / p;
+    int remainder = n % p;
+    int split = remainder * (base + 1);
+    return k < split ? k / (base + 1) : remainder + (k - split) / base;
+}
+
+// Function to generate entry (i, j) of matrix `which` (0 = A, 1 = B, 2 = the check vector)
+// from the seed, as an integer in [0, 9] from stream `which` of the counter-based generator.
+// Every process fills its own blocks, so no process ever holds a whole matrix.
+double matrix_entry(uint64_t seed, int which, int i, int j) {
+    return (double)bits_to_int(random_u64(seed, which, (uint64_t)i << 32 | (uint32_t)j), 0, 9);
+}
+
+// Function to set up the 2D process grid and the local block of every matrix. A, B and C are
+// split the same way: rows over the process rows, columns over the process columns.
+void setup_grid(Grid *g, int n) {
+    int periods[2] = {0, 0};
+    int keep_columns[2] = {0, 1}, keep_rows[2] = {1, 0};
+
+    MPI_Comm_size(MPI_COMM_WORLD, &g->size);
+    g->n = n;
+    g->dims[0] = g->dims[1] = 0;
+    MPI_Dims_create(g->size, 2, g->dims);
+    MPI_Cart_create(MPI_COMM_WORLD, 2, g->dims, periods, 1, &g->comm);
+    MPI_Comm_rank(g->comm, &g->rank);
+    MPI_Cart_coords(g->comm, g->rank, 2, g->coords);
+
+    // row_comm links a process row (ranked by column), col_comm a process column (by row)
+    MPI_Cart_sub(g->comm, keep_columns, &g->row_comm);
+    MPI_Cart_sub(g->comm, keep_rows, &g->col_comm);
+
+    block_range(n, g->dims[0], g->coords[0], &g->row0, &g->rows);
+    block_range(n, g->dims[1], g->coords[1], &g->col0, &g->cols);
+}
+
+void free_grid(Grid *g) {
+    MPI_Comm_free(&g->row_comm);
+    MPI_Comm_free(&g->col_comm);
+    MPI_Comm_free(&g->comm);
+}
+
+// Function to get the width of the SUMMA panel starting at global index k: at most panel
+// columns of A and rows of B, and never across the edge of a block owned by another process
+int panel_width(const Grid *g, int k, int panel) {
+    int start, count, width = panel;
+
+    block_range(g->n, g->dims[1], block_owner(g->n, g->dims[1], k), &start, &count);
+    if (start + count - k < width) width = start + count - k;
+    block_range(g->n, g->dims[0], block_owner(g->n, g->dims[0], k), &start, &count);
+    if (start + count - k < width) width = start + count - k;
+    return width;
+}
+
+// Function to post the broadcasts of the panel at k: its columns of A along the process rows
+// and its rows of B along the process columns
+void start_panel(const Grid *g, const double *A, const double *B, int k, int width,
+                 double *a_panel, double *b_panel, MPI_Request requests[2]) {
+    int a_root = block_owner(g->n, g->dims[1], k);
+    int b_root = block_owner(g->n, g->dims[0], k);
+
+    if (g->coords[1] == a_root) {
+        for (int i = 0; i < g->rows; i++)
+            memcpy(a_panel + (size_t)i * width, A + (size_t)i * g->cols + (k - g->col0),
+                   width * sizeof(double));
+    }
+    if (g->coords[0] == b_root) {
+        memcpy(b_panel, B + (size_t)(k - g->row0) * g->cols, (size_t)width * g->cols * sizeof(double));
+    }
+    MPI_Ibcast(a_panel, g->rows * width, MPI_DOUBLE, a_root, g->row_comm, &requests[0]);
+    MPI_Ibcast(b_panel, width * g->cols, MPI_DOUBLE, b_root, g->col_comm, &requests[1]);
+}
+
+// Function to compute C += A B with SUMMA: for each panel of the inner dimension, the owners
+// broadcast their part of A along the process rows and of B along the process columns, and
+// every process multiplies the two panels into its block of C. The broadcasts of the next
+// panel are in flight while the current one is multiplied.
+void summa_multiply(const Grid *g, const double *A, const double *B, double *C, int panel,
+                    const PackBuffers *pack) {
+    double *a_panel[2], *b_panel[2];
+    MPI_Request requests[2][2];
+    int cur = 0;
+
+    for (int t = 0; t < 2; t++) {
+        a_panel[t] = alloc_matrix((size_t)g->rows * panel);
+        b_panel[t] = alloc_matrix((size_t)panel * g->cols);
+    }
+
+    int k = 0;
+    int width = panel_width(g, k, panel);
+    start_panel(g, A, B, k, width, a_panel[cur], b_panel[cur], requests[cur]);
+    while (k < g->n) {
+        int next = k + width;
+        int next_width = next < g->n ? panel_width(g, next, panel) : 0;
+        if (next < g->n) {
+            start_panel(g, A, B, next, next_width, a_panel[1 - cur], b_panel[1 - cur],
+                        requests[1 - cur]);
+        }
+
+        MPI_Waitall(2, requests[cur], MPI_STATUSES_IGNORE);
+        multiply_matrix(g->rows, g->cols, width, a_panel[cur], width, b_panel[cur], g->cols,
+                        C, g->cols, pack);
+
+        k = next;
+        width = next_width;
+        cur = 1 - cur;
+    }
+
+    for (int t = 0; t < 2; t++) {
+        free(a_panel[t]);
+        free(b_panel[t]);
+    }
+}
+
+// Function to compute C += A B with Cannon's algorithm on a square q x q process grid. After an
+// initial skew, process (i, j) holds A(i, i + j) and B(i + j, j); each of the q steps multiplies
+// the held blocks while they are already being shifted one process left (A) and up (B).
+void cannon_multiply(const Grid *g, const double *A, const double *B, double *C,
+                     const PackBuffers *pack) {
+    int q = g->dims[0], i = g->coords[0], j = g->coords[1];
+    int max_block = (g->n + q - 1) / q;
+    double *a[2], *b[2];
+    MPI_Request requests[4];
+    int start, size_k, size_next = 0, cur = 0;
+
+    for (int t = 0; t < 2; t++) {
+        a[t] = alloc_matrix((size_t)g->rows * max_block);
+        b[t] = alloc_matrix((size_t)max_block * g->cols);
+    }
+
+    // Skew: A(i, j) moves i processes left, B(i, j) moves j processes up
+    int kk = (i + j) % q;
+    block_range(g->n, q, kk, &start, &size_k);
+    MPI_Sendrecv(A, g->rows * g->cols, MPI_DOUBLE, (j - i + q) % q, 0,
+                 a[cur], g->rows * size_k, MPI_DOUBLE, kk, 0, g->row_comm, MPI_STATUS_IGNORE);
+    MPI_Sendrecv(B, g->rows * g->cols, MPI_DOUBLE, (i - j + q) % q, 1,
+                 b[cur], size_k * g->cols, MPI_DOUBLE, kk, 1, g->col_comm, MPI_STATUS_IGNORE);
+
+    for (int s = 0; s < q; s++) {
+        int count = 0;
+        if (s < q - 1) {
+            block_range(g->n, q, (kk + 1) % q, &start, &size_next);
+            MPI_Irecv(a[1 - cur], g->rows * size_next, MPI_DOUBLE, (j + 1) % q, 0,
+                      g->row_comm, &requests[count++]);
+            MPI_Irecv(b[1 - cur], size_next * g->cols, MPI_DOUBLE, (i + 1) % q, 1,
+                      g->col_comm, &requests[count++]);
+            MPI_Isend(a[cur], g->rows * size_k, MPI_DOUBLE, (j - 1 + q) % q, 0,
+                      g->row_comm, &requests[count++]);
+            MPI_Isend(b[cur], size_k * g->cols, MPI_DOUBLE, (i - 1 + q) % q, 1,
+                      g->col_comm, &requests[count++]);
+        }
+
+        multiply_matrix(g->rows, g->cols, size_k, a[cur], size_k, b[cur], g->cols, C, g->cols,
+                        pack);
+
+        MPI_Waitall(count, requests, MPI_STATUSES_IGNORE);
+        kk = (kk + 1) % q;
+        size_k = size_next;
+        cur = 1 - cur;
+    }
+
+    for (int t = 0; t < 2; t++) {
+        free(a[t]);
+        free(b[t]);
+    }
+}
+
+// Function to check C = A B against the reference A (B x) for a seeded integer vector x,
+// using only the local blocks and vectors of length n. With the generated small-integer
+// entries both sides are exact and must agree exactly (tolerance 0); for matrices read from
+// files a row may differ by tolerance times the largest reference entry. Returns the number
+// of mismatching rows (on the master).
+int verify_product(const Grid *g, uint64_t seed, const double *A, const double *B,
+                   const double *C, double tolerance) {
+    int n = g->n;
+    double *x = alloc_matrix(n), *y = alloc_matrix(n);
+    double *partial = alloc_matrix(2 * (size_t)n), *total = alloc_matrix(2 * (size_t)n);
+    int errors = 0;
+
+    for (int i = 0; i < n; i++)
+        x[i] = matrix_entry(seed, 2, 0, i);
+
+    // y = B x, summed over the process columns that share each row
+    memset(y, 0, n * sizeof(double));
+    for (int i = 0; i < g->rows; i++)
+        for (int j = 0; j < g->cols; j++)
+            y[g->row0 + i] += B[(size_t)i * g->cols + j] * x[g->col0 + j];
+    MPI_Allreduce(MPI_IN_PLACE, y, n, MPI_DOUBLE, MPI_SUM, g->comm);
+
+    // A y (the reference) and C x, side by side
+    memset(partial, 0, 2 * (size_t)n * sizeof(double));
+    for (int i = 0; i < g->rows; i++)
+        for (int j = 0; j < g->cols; j++) {
+            partial[g->row0 + i] += A[(size_t)i * g->cols + j] * y[g->col0 + j];
+            partial[n + g->row0 + i] += C[(size_t)i * g->cols + j] * x[g->col0 + j];
         }
+    MPI_Reduce(partial, total, 2 * n, MPI_DOUBLE, MPI_SUM, 0, g->comm);
+
+    if (g->rank == 0) {
+        double largest = 0.0;
+        for (int i = 0; i < n; i++)
+            if (fabs(total[i]) > largest) largest = fabs(total[i]);
+        for (int i = 0; i < n; i++)
+            if (fabs(total[i] - total[n + i]) > tolerance * largest) errors++;
+    }
+
+    free(x);
+    free(y);
+    free(partial);
+    free(total);
+    return errors;
 }
 
 int main(int argc, char** argv) {
     int rank, size;
-    double A[N][N], B[N][N], C[N][N];
-    double local_A[N / 2][N], local_C[N / 2][N];
+    int n = N, algorithm = SUMMA, panel = KC, method = LOAD_MPIIO;
+    const char *input[2] = {NULL, NULL};
+    ArrayHeader header[2];
+    Grid grid;
 
     MPI_Init(&argc, &argv);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
-    if (rank == 0) {
-        srand(time(NULL));
-        for (int i = 0; i < N; i++)
-            for (int j = 0; j < N; j++) {
-                A[i][j] = rand() % 10;
-                B[i][j] = rand() % 10;
-            }
+    int bad = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--algorithm") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "summa") == 0) algorithm = SUMMA;
+            else if (strcmp(argv[i], "cannon") == 0) algorithm = CANNON;
+            else bad = 1;
+        } else if (strcmp(argv[i], "--panel") == 0 && i + 1 < argc) {
+            panel = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--input") == 0 && i + 2 < argc) {
+            input[0] = argv[++i];
+            input[1] = argv[++i];
+        } else if (strcmp(argv[i], "--mmap") == 0) {
+            method = LOAD_MMAP;
+        } else if (argv[i][0] != '-') {
+            n = atoi(argv[i]);
+        } else {
+            bad = 1;
+        }
+    }
+    if (bad || n < 1 || panel < 1) {
+        if (rank == 0) printf("Usage: %s [N] [--algorithm summa|cannon] [--panel B] [--input A.bin B.bin [--mmap]]\n", argv[0]);
+        MPI_Finalize();
+        return 1;
     }
 
-    MPI_Bcast(B, N * N, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-    MPI_Scatter(A, (N * N) / size, MPI_DOUBLE, local_A, (N * N) / size, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    // With input files the matrix size comes from their headers
+    if (input[0] != NULL) {
+        if (read_array_header(input[0], &header[0], MPI_COMM_WORLD) != 0 ||
+            read_array_header(input[1], &header[1], MPI_COMM_WORLD) != 0) {
+            MPI_Finalize();
+            return 1;
+        }
+        if (header[0].type != ARRAY_DOUBLE || header[1].type != ARRAY_DOUBLE ||
+            header[0].rows != header[0].cols || header[1].rows != header[0].rows ||
+            header[1].cols != header[0].cols || header[0].rows < 1 || header[0].rows > 65535) {
+            if (rank == 0) printf("The inputs must be two square double matrices of the same size\n");
+            MPI_Finalize();
+            return 1;
+        }
+        n = (int)header[0].rows;
+    }
+
+    setup_grid(&grid, n);
+    rank = grid.rank;
+    // Every process must own a block; all of them have to agree before anyone stops
+    int local_empty = grid.rows < 1 || grid.cols < 1, any_empty;
+    MPI_Allreduce(&local_empty, &any_empty, 1, MPI_INT, MPI_LOR, grid.comm);
+    if (any_empty || (algorithm == CANNON && grid.dims[0] != grid.dims[1])) {
+        if (rank == 0) {
+            if (any_empty)
+                printf("N = %d is too small for a %d x %d process grid\n", n, grid.dims[0], grid.dims[1]);
+            else
+                printf("Cannon's algorithm needs a square process grid, not %d x %d\n",
+                       grid.dims[0], grid.dims[1]);
+        }
+        free_grid(&grid);
+        MPI_Finalize();
+        return 1;
+    }
+
+    // Every process generates its own blocks from a shared seed, or reads them from the files
+    uint64_t seed = (uint64_t)time(NULL);
+    MPI_Bcast(&seed, 1, MPI_UINT64_T, 0, grid.comm);
+
+    size_t local = (size_t)grid.rows * grid.cols;
+    double *A = alloc_matrix(local), *B = alloc_matrix(local), *C = alloc_matrix(local);
+    double load_time = 0.0;
+    if (input[0] != NULL) {
+        MPI_Barrier(grid.comm);
+        load_time = MPI_Wtime();
+        read_block(input[0], &header[0], grid.row0, grid.rows, grid.col0, grid.cols, A, method, grid.comm);
+        read_block(input[1], &header[1], grid.row0, grid.rows, grid.col0, grid.cols, B, method, grid.comm);
+        load_time = MPI_Wtime() - load_time;
+        MPI_Allreduce(MPI_IN_PLACE, &load_time, 1, MPI_DOUBLE, MPI_MAX, grid.comm);
+    } else {
+        for (int i = 0; i < grid.rows; i++)
+            for (int j = 0; j < grid.cols; j++) {
+                A[(size_t)i * grid.cols + j] = matrix_entry(seed, 0, grid.row0 + i, grid.col0 + j);
+                B[(size_t)i * grid.cols + j] = matrix_entry(seed, 1, grid.row0 + i, grid.col0 + j);
+            }
+    }
+    memset(C, 0, local * sizeof(double));
+    PackBuffers pack;
+    alloc_pack_buffers(&pack, grid.rows, grid.cols, n);
 
+    MPI_Barrier(grid.comm);
     double start_time = MPI_Wtime();
-    multiply_matrix(N / size, local_A, B, local_C);
-    MPI_Gather(local_C, (N * N) / size, MPI_DOUBLE, C, (N * N) / size, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    if (algorithm == CANNON) {
+        cannon_multiply(&grid, A, B, C, &pack);
+    } else {
+        summa_multiply(&grid, A, B, C, panel, &pack);
+    }
     double run_time = MPI_Wtime() - start_time;
 
+    // The slowest process bounds the run
+    double max_time;
+    MPI_Reduce(&run_time, &max_time, 1, MPI_DOUBLE, MPI_MAX, 0, grid.comm);
+
+    int errors = verify_product(&grid, seed, A, B, C, input[0] != NULL ? 1e-12 * n : 0.0);
+
     if (rank == 0) {
-        printf("Parallel MPI Matrix Multiplication Time: %f seconds\n", run_time);
+        double flops = 2.0 * n * n * (double)n;
+        printf("Matrix size: %d x %d on a %d x %d process grid, %s, kernel: %s\n", n, n,
+               grid.dims[0], grid.dims[1], algorithm == CANNON ? "Cannon" : "SUMMA", kernel_isa());
+        printf("Local blocks: %d x %d (%.1f MB per matrix)\n", grid.rows, grid.cols,
+               local * sizeof(double) / 1e6);
+        if (input[0] != NULL) {
+            printf("Loaded %s and %s with %s in %f seconds (%.2f GB/s)\n", input[0], input[1],
+                   method == LOAD_MMAP ? "mmap" : "MPI-IO", load_time,
+                   2.0 * n * (double)n * sizeof(double) / load_time / 1e9);
+        }
+        printf("Parallel MPI Matrix Multiplication Time: %f seconds\n", max_time);
+        printf("Performance: %.2f GFLOP/s overall, %.2f GFLOP/s per process\n",
+               flops / max_time / 1e9, flops / max_time / 1e9 / size);
+        if (errors == 0) {
+            printf("Verification against A(Bx): passed\n");
+        } else {
+            printf("Verification against A(Bx): FAILED in %d rows\n", errors);
+        }
     }
 
+    free(A);
+    free(B);
+    free(C);
+    free_pack_buffers(&pack);
+    free_grid(&grid);
     MPI_Finalize();
     return 0;
 }
 
-
 //for serial execution
 // #include <stdio.h>
 // #include <stdlib.h>
@@ -1,9 +1,41 @@
 #include <mpi.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <math.h>
+#include <limits.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-#define N 20  // Array size
+#define N 20  // Default array size
+#define MAX_KEY 100     // Default key range [0, MAX_KEY)
+#define PRINT_LIMIT 40  // Arrays up to this size are printed
+#define OVERSAMPLING 8  // Regular samples per process and destination; bounds the imbalance
+#define MAX_QUANTILES 64    // Most quantiles per selection
+
+// Sample of the locally sorted data. The position breaks ties between equal keys, so every
+// key is distinct as (key, rank, pos) and heavy duplicates still split evenly.
+typedef struct {
+    long long key, rank, pos;
+} Sample;
+
+// Part of the key range still searched by distributed selection. All processes hold the same
+// segments; only the local index range differs. The queries of a segment are the wanted global
+// ranks order[first .. last - 1], which all lie among its keys.
+typedef struct {
+    long lo, hi;            // Local keys of the segment: a[lo, hi)
+    long long base;         // Global number of keys ordered before the segment
+    int first, last;
+} Segment;
+
+// Pivot proposal of one process for a segment, reduced with MPI_MAXLOC as MPI_DOUBLE_INT:
+// the highest priority wins and carries its key along
+typedef struct {
+    double priority;
+    int key;
+} Proposal;
 
 void swap(int *a, int *b) {
     int temp = *a;
@@ -11,51 +43,541 @@ void swap(int *a, int *b) {
     *b = temp;
 }
 
-void odd_even_sort(int local_array[], int n, int rank, int size, MPI_Comm comm) {
-    for (int phase = 0; phase < n; phase++) {
-        int partner = (phase % 2 == 0) ? rank ^ 1 : rank ^ 1;
-        if (partner >= 0 && partner < size) {
-            int temp_array[n];
-            MPI_Sendrecv(local_array, n, MPI_INT, partner, 0,
-                         temp_array, n, MPI_INT, partner, 0, comm, MPI_STATUS_IGNORE);
-            for (int i = 0; i < n; i++) {
-                if ((rank < partner && local_array[i] > temp_array[i]) ||
-                    (rank > partner && local_array[i] < temp_array[i])) {
-                    swap(&local_array[i], &temp_array[i]);
-                }
+// Function to get the number of threads that share the work of one process
+int worker_threads(void) {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+int compare_int(const void *a, const void *b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+int compare_sample(const void *a, const void *b) {
+    const Sample *x = (const Sample*)a, *y = (const Sample*)b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    if (x->rank != y->rank) return x->rank < y->rank ? -1 : 1;
+    return (x->pos > y->pos) - (x->pos < y->pos);
+}
+
+void *checked_malloc(size_t bytes) {
+    void *ptr = malloc(bytes > 0 ? bytes : 1);
+    if (ptr == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    return ptr;
+}
+
+// Function to merge the sorted ranges a[0, na) and b[0, nb) into out
+void merge(const int *a, long na, const int *b, long nb, int *out) {
+    long i = 0, j = 0, k = 0;
+    while (i < na && j < nb) out[k++] = b[j] < a[i] ? b[j++] : a[i++];
+    while (i < na) out[k++] = a[i++];
+    while (j < nb) out[k++] = b[j++];
+}
+
+// Function to sort n keys with the threads of the process: every thread sorts one chunk,
+// then neighbouring chunks are merged pairwise, in parallel, until one run is left.
+// tmp must hold n keys.
+void parallel_sort(int *a, long n, int *tmp) {
+    int chunks = worker_threads();
+    long *bounds = (long*)checked_malloc((chunks + 1) * sizeof(long));
+    int *src = a, *dst = tmp;
+
+    for (int c = 0; c <= chunks; c++) bounds[c] = n * c / chunks;
+
+    #pragma omp parallel for schedule(static)
+    for (int c = 0; c < chunks; c++) {
+        qsort(a + bounds[c], bounds[c + 1] - bounds[c], sizeof(int), compare_int);
+    }
+
+    for (int width = 1; width < chunks; width *= 2) {
+        #pragma omp parallel for schedule(static)
+        for (int c = 0; c < chunks; c += 2 * width) {
+            long lo = bounds[c];
+            long mid = bounds[c + width < chunks ? c + width : chunks];
+            long hi = bounds[c + 2 * width < chunks ? c + 2 * width : chunks];
+            merge(src + lo, mid - lo, src + mid, hi - mid, dst + lo);
+        }
+        int *t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != a) memcpy(a, src, n * sizeof(int));
+    free(bounds);
+}
+
+// Function to count the local keys that order before the splitter s: smaller keys, and equal
+// keys whose (rank, position) comes first
+long split_point(const int *a, long n, int rank, const Sample *s) {
+    long lo = 0, hi = n;
+    // First key >= s->key
+    while (lo < hi) {
+        long mid = (lo + hi) / 2;
+        if (a[mid] < s->key) lo = mid + 1;
+        else hi = mid;
+    }
+    if (rank < s->rank) {
+        // All equal keys of this rank come first: skip to the first key > s->key
+        hi = n;
+        while (lo < hi) {
+            long mid = (lo + hi) / 2;
+            if (a[mid] <= s->key) lo = mid + 1;
+            else hi = mid;
+        }
+    } else if (rank == s->rank && s->pos > lo) {
+        lo = s->pos;
+    }
+    return lo;
+}
+
+// Function to merge k sorted runs, run r being in[start[r], start[r + 1]), into out with a
+// binary min-heap of the run heads
+void kway_merge(const int *in, const int *start, int k, int *out) {
+    int *heap = (int*)checked_malloc(k * sizeof(int));      // Run numbers ordered by head key
+    int *pos = (int*)checked_malloc(k * sizeof(int));
+    int count = 0;
+    long n = 0;
+
+    for (int r = 0; r < k; r++) {
+        pos[r] = start[r];
+        if (start[r] < start[r + 1]) heap[count++] = r;
+    }
+    // Heapify
+    for (int i = count / 2 - 1; i >= 0; i--) {
+        for (int p = i;;) {
+            int c = 2 * p + 1;
+            if (c >= count) break;
+            if (c + 1 < count && in[pos[heap[c + 1]]] < in[pos[heap[c]]]) c++;
+            if (in[pos[heap[p]]] <= in[pos[heap[c]]]) break;
+            swap(&heap[p], &heap[c]);
+            p = c;
+        }
+    }
+
+    while (count > 0) {
+        int r = heap[0];
+        out[n++] = in[pos[r]++];
+        if (pos[r] == start[r + 1]) heap[0] = heap[--count];
+        // Sift the new head down
+        for (int p = 0;;) {
+            int c = 2 * p + 1;
+            if (c >= count) break;
+            if (c + 1 < count && in[pos[heap[c + 1]]] < in[pos[heap[c]]]) c++;
+            if (in[pos[heap[p]]] <= in[pos[heap[c]]]) break;
+            swap(&heap[p], &heap[c]);
+            p = c;
+        }
+    }
+    free(heap);
+    free(pos);
+}
+
+// Function to sort the distributed array with sample sort (parallel sorting by regular
+// sampling): sort locally, gather OVERSAMPLING * size regular samples per process on rank 0,
+// which picks size - 1 splitters and broadcasts them, redistribute with one MPI_Alltoallv and
+// merge the received runs. On return *data holds *count keys, and the keys of rank r all
+// order before those of rank r + 1.
+void sample_sort(int **data, long *count, int rank, int size, MPI_Comm comm, double times[4]) {
+    int *a = *data;
+    long n = *count;
+    int *tmp = (int*)checked_malloc(n * sizeof(int));
+    double t0 = MPI_Wtime();
+
+    parallel_sort(a, n, tmp);
+    free(tmp);
+    double t1 = MPI_Wtime();
+
+    // Regular samples of the local run; a process with no keys contributes none
+    int per_process = OVERSAMPLING * size;
+    int num_samples = n >= per_process ? per_process : (int)n;
+    Sample *samples = (Sample*)checked_malloc(num_samples * sizeof(Sample));
+    Sample *splitters = (Sample*)checked_malloc(size * sizeof(Sample));
+    for (int i = 0; i < num_samples; i++) {
+        long p = (long)((double)n * i / num_samples);
+        samples[i].key = a[p];
+        samples[i].rank = rank;
+        samples[i].pos = p;
+    }
+
+    int sample_values = 3 * num_samples, total_samples = 0;
+    int *sample_counts = NULL, *sample_displs = NULL;
+    Sample *all = NULL;
+    if (rank == 0) {
+        sample_counts = (int*)checked_malloc(size * sizeof(int));
+        sample_displs = (int*)checked_malloc(size * sizeof(int));
+    }
+    MPI_Gather(&sample_values, 1, MPI_INT, sample_counts, 1, MPI_INT, 0, comm);
+    if (rank == 0) {
+        for (int r = 0; r < size; r++) {
+            sample_displs[r] = total_samples;
+            total_samples += sample_counts[r];
+        }
+        all = (Sample*)checked_malloc((total_samples / 3) * sizeof(Sample));
+    }
+    MPI_Gatherv(samples, sample_values, MPI_LONG_LONG, all, sample_counts, sample_displs,
+                MPI_LONG_LONG, 0, comm);
+    if (rank == 0) {
+        total_samples /= 3;
+        qsort(all, total_samples, sizeof(Sample), compare_sample);
+        for (int r = 1; r < size; r++) {
+            splitters[r] = all[(long)total_samples * r / size];
+        }
+    }
+    MPI_Bcast(&total_samples, 1, MPI_INT, 0, comm);
+    MPI_Bcast(splitters, 3 * size, MPI_LONG_LONG, 0, comm);
+
+    // Splitter r + 1 separates the keys of rank r from those of rank r + 1
+    int *send_counts = (int*)checked_malloc(size * sizeof(int));
+    int *send_displs = (int*)checked_malloc(size * sizeof(int));
+    int *recv_counts = (int*)checked_malloc(size * sizeof(int));
+    int *recv_displs = (int*)checked_malloc((size + 1) * sizeof(int));
+    long prev = 0;
+    for (int r = 0; r < size; r++) {
+        long next = n;
+        if (r < size - 1 && total_samples > 0) {
+            next = split_point(a, n, rank, &splitters[r + 1]);
+        }
+        if (next < prev) next = prev;
+        send_displs[r] = (int)prev;
+        send_counts[r] = (int)(next - prev);
+        prev = next;
+    }
+    double t2 = MPI_Wtime();
+
+    MPI_Alltoall(send_counts, 1, MPI_INT, recv_counts, 1, MPI_INT, comm);
+    recv_displs[0] = 0;
+    for (int r = 0; r < size; r++) recv_displs[r + 1] = recv_displs[r] + recv_counts[r];
+    long received = recv_displs[size];
+    int *incoming = (int*)checked_malloc(received * sizeof(int));
+    MPI_Alltoallv(a, send_counts, send_displs, MPI_INT,
+                  incoming, recv_counts, recv_displs, MPI_INT, comm);
+    free(a);
+    double t3 = MPI_Wtime();
+
+    int *sorted = (int*)checked_malloc(received * sizeof(int));
+    kway_merge(incoming, recv_displs, size, sorted);
+    free(incoming);
+    double t4 = MPI_Wtime();
+
+    times[0] = t1 - t0;     // Local sort
+    times[1] = t2 - t1;     // Sampling and splitters
+    times[2] = t3 - t2;     // Redistribution
+    times[3] = t4 - t3;     // Merge
+    *data = sorted;
+    *count = received;
+
+    free(samples);
+    free(splitters);
+    free(all);
+    free(sample_counts);
+    free(sample_displs);
+    free(send_counts);
+    free(send_displs);
+    free(recv_counts);
+    free(recv_displs);
+}
+
+// Function to split a[lo, hi) in place into keys < pivot, == pivot and > pivot; returns the
+// ends of the first two parts in *lt and *eq
+void partition3(int *a, long lo, long hi, int pivot, long *lt, long *eq) {
+    long i = lo, l = lo, g = hi;
+    while (i < g) {
+        if (a[i] < pivot) swap(&a[l++], &a[i++]);
+        else if (a[i] > pivot) swap(&a[i], &a[--g]);
+        else i++;
+    }
+    *lt = l;
+    *eq = g;
+}
+
+// Function to find the keys of the given global ranks (0-based, in sorted order) of the
+// distributed array without sorting or moving it, by quickselect on all ranks at once.
+// In every round each segment gets a pivot drawn uniformly from its keys of all processes,
+// agreed with one MPI_Allreduce (MPI_MAXLOC over random priorities carrying the keys);
+// every process partitions its part of the segment around the pivot, and a second
+// MPI_Allreduce of the counts tells which side holds each query. Segments shrink by a
+// constant factor per round on average, so O(log N) rounds are needed. The local keys are
+// reordered. Returns the number of rounds.
+int select_ranks(int *a, long n, const long long *ranks, int q, int *result, int rank, MPI_Comm comm) {
+    int *order = (int*)checked_malloc(q * sizeof(int));
+    Segment *segs = (Segment*)checked_malloc(q * sizeof(Segment));
+    Segment *next = (Segment*)checked_malloc(q * sizeof(Segment));
+    Proposal *proposal = (Proposal*)checked_malloc(q * sizeof(Proposal));
+    Proposal *pivots = (Proposal*)checked_malloc(q * sizeof(Proposal));
+    long long *counts = (long long*)checked_malloc(2 * q * sizeof(long long));
+    long long *totals = (long long*)checked_malloc(2 * q * sizeof(long long));
+    long *bounds = (long*)checked_malloc(2 * q * sizeof(long));
+    unsigned int seed = 2654435761u * (unsigned int)(rank + 1);
+    int num_segs = 0, rounds = 0;
+
+    // Queries sorted by rank, so each side of a partition takes a contiguous range of them
+    for (int i = 0; i < q; i++) order[i] = i;
+    for (int i = 1; i < q; i++) {
+        for (int j = i; j > 0 && ranks[order[j]] < ranks[order[j - 1]]; j--) swap(&order[j], &order[j - 1]);
+    }
+    if (q > 0) {
+        segs[0].lo = 0;
+        segs[0].hi = n;
+        segs[0].base = 0;
+        segs[0].first = 0;
+        segs[0].last = q;
+        num_segs = 1;
+    }
+
+    while (num_segs > 0) {
+        rounds++;
+        for (int s = 0; s < num_segs; s++) {
+            // Weighted draw: priority log(u) / w, the logarithm of u^(1/w), makes the chance of
+            // a process winning proportional to its w keys in the segment. Kept as a double it
+            // stays distinct even for large w, where u^(1/w) itself crowds against 1.
+            long w = segs[s].hi - segs[s].lo;
+            proposal[s].priority = -INFINITY;
+            proposal[s].key = 0;
+            if (w > 0) {
+                seed = seed * 1103515245u + 12345u;
+                double u = ((seed >> 1) + 1.0) / 2147483649.0;
+                seed = seed * 1103515245u + 12345u;
+                long pick = segs[s].lo + (long)((seed >> 1) % (unsigned long)w);
+                proposal[s].priority = log(u) / w;
+                proposal[s].key = a[pick];
+            }
+        }
+        MPI_Allreduce(proposal, pivots, num_segs, MPI_DOUBLE_INT, MPI_MAXLOC, comm);
+
+        for (int s = 0; s < num_segs; s++) {
+            int pivot = pivots[s].key;
+            partition3(a, segs[s].lo, segs[s].hi, pivot, &bounds[2 * s], &bounds[2 * s + 1]);
+            counts[2 * s] = bounds[2 * s] - segs[s].lo;
+            counts[2 * s + 1] = bounds[2 * s + 1] - bounds[2 * s];
+        }
+        MPI_Allreduce(counts, totals, 2 * num_segs, MPI_LONG_LONG, MPI_SUM, comm);
+
+        int num_next = 0;
+        for (int s = 0; s < num_segs; s++) {
+            int pivot = pivots[s].key;
+            long long less = totals[2 * s], equal = totals[2 * s + 1];
+            int j = segs[s].first, k;
+            while (j < segs[s].last && ranks[order[j]] - segs[s].base < less) j++;
+            for (k = j; k < segs[s].last && ranks[order[k]] - segs[s].base < less + equal; k++) {
+                result[order[k]] = pivot;
             }
+            if (j > segs[s].first) {
+                Segment below = {segs[s].lo, bounds[2 * s], segs[s].base, segs[s].first, j};
+                next[num_next++] = below;
+            }
+            if (k < segs[s].last) {
+                Segment above = {bounds[2 * s + 1], segs[s].hi, segs[s].base + less + equal, k, segs[s].last};
+                next[num_next++] = above;
+            }
+        }
+        Segment *t = segs;
+        segs = next;
+        next = t;
+        num_segs = num_next;
+    }
+
+    free(order);
+    free(segs);
+    free(next);
+    free(proposal);
+    free(pivots);
+    free(counts);
+    free(totals);
+    free(bounds);
+    return rounds;
+}
+
+// Function to read the keys of the given global ranks from the sorted distributed array
+void index_sorted(const int *a, long n, const long long *ranks, int q, int *result, MPI_Comm comm) {
+    long long local = n, offset = 0;
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Exscan(&local, &offset, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    if (rank == 0) offset = 0;
+
+    int *found = (int*)checked_malloc(q * sizeof(int));
+    for (int i = 0; i < q; i++) {
+        long long k = ranks[i] - offset;
+        found[i] = k >= 0 && k < n ? a[k] : INT_MIN;
+    }
+    MPI_Allreduce(found, result, q, MPI_INT, MPI_MAX, comm);
+    free(found);
+}
+
+// Function to check that the distributed array is sorted and still holds total keys
+int check_sorted(const int *a, long n, long long total, int rank, int size, MPI_Comm comm) {
+    int ok = 1;
+    long long count = n, global_count;
+    for (long i = 1; i < n; i++)
+        if (a[i - 1] > a[i]) ok = 0;
+
+    // The last key of every non-empty process must not exceed the next non-empty first key;
+    // a running maximum passed along the ranks covers empty processes
+    int has_prev, prev_max, my_max;
+    int prev_in[2] = {0, 0}, out[2];
+    if (rank > 0) MPI_Recv(prev_in, 2, MPI_INT, rank - 1, 0, comm, MPI_STATUS_IGNORE);
+    has_prev = prev_in[0];
+    prev_max = prev_in[1];
+    if (has_prev && n > 0 && prev_max > a[0]) ok = 0;
+    my_max = n > 0 ? a[n - 1] : prev_max;
+    out[0] = has_prev || n > 0;
+    out[1] = my_max;
+    if (rank < size - 1) MPI_Send(out, 2, MPI_INT, rank + 1, 0, comm);
+
+    int all_ok;
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_MIN, comm);
+    MPI_Allreduce(&count, &global_count, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    return all_ok && global_count == total;
+}
+
+// Function to gather and print a small distributed array on rank 0
+void print_array(const char *label, const int *a, long n, int rank, int size, MPI_Comm comm) {
+    int count = (int)n;
+    int *counts = NULL, *displs = NULL, *all = NULL;
+    if (rank == 0) {
+        counts = (int*)checked_malloc(size * sizeof(int));
+        displs = (int*)checked_malloc(size * sizeof(int));
+    }
+    MPI_Gather(&count, 1, MPI_INT, counts, 1, MPI_INT, 0, comm);
+    int total = 0;
+    if (rank == 0) {
+        for (int r = 0; r < size; r++) {
+            displs[r] = total;
+            total += counts[r];
         }
+        all = (int*)checked_malloc(total * sizeof(int));
+    }
+    MPI_Gatherv(a, count, MPI_INT, all, counts, displs, MPI_INT, 0, comm);
+    if (rank == 0) {
+        printf("%s: ", label);
+        for (int i = 0; i < total; i++) printf("%d ", all[i]);
+        printf("\n");
+        free(counts);
+        free(displs);
+        free(all);
     }
 }
 
 int main(int argc, char** argv) {
     int rank, size;
-    int local_array[N / 4];  // Divide among processes
-    int global_array[N];
+    long long n = N;
+    int max_key = MAX_KEY;
+    double times[4];
+    double quantiles[MAX_QUANTILES];
+    int num_quantiles = 0;
 
     MPI_Init(&argc, &argv);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
-    if (rank == 0) {
-        srand(time(NULL));
-        for (int i = 0; i < N; i++) global_array[i] = rand() % 100;
-        printf("Unsorted array: ");
-        for (int i = 0; i < N; i++) printf("%d ", global_array[i]);
-        printf("\n");
+    int bad = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--max-key") == 0 && i + 1 < argc) {
+            max_key = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--quantiles") == 0 && i + 1 < argc) {
+            // Comma-separated fractions in [0, 1], e.g. 0.5,0.99
+            char *p = argv[++i], *end;
+            while (*p != '\0' && num_quantiles < MAX_QUANTILES) {
+                quantiles[num_quantiles] = strtod(p, &end);
+                if (end == p || quantiles[num_quantiles] < 0 || quantiles[num_quantiles] > 1) {
+                    bad = 1;
+                    break;
+                }
+                num_quantiles++;
+                p = *end == ',' ? end + 1 : end;
+            }
+        } else if (argv[i][0] != '-') {
+            n = atoll(argv[i]);
+        } else {
+            bad = 1;
+        }
+    }
+    if (bad || n < 1 || max_key < 1) {
+        if (rank == 0) printf("Usage: %s [N] [--max-key M] [--quantiles Q1,Q2,...]\n", argv[0]);
+        MPI_Finalize();
+        return 1;
+    }
+
+    // Every process generates its own share of the keys
+    long local_n = (long)(n / size + (rank < n % size ? 1 : 0));
+    int *local_array = (int*)checked_malloc(local_n * sizeof(int));
+    unsigned int seed = (unsigned int)time(NULL) * 2654435761u + (unsigned int)rank * 40503u;
+    for (long i = 0; i < local_n; i++) {
+        seed = seed * 1103515245u + 12345u;
+        local_array[i] = (int)((seed >> 1) % (unsigned int)max_key);
+    }
+
+    if (n <= PRINT_LIMIT) print_array("Unsorted array", local_array, local_n, rank, size, MPI_COMM_WORLD);
+
+    // Selection works on a copy, since it reorders the local keys
+    long long ranks[MAX_QUANTILES];
+    int selected[MAX_QUANTILES], indexed[MAX_QUANTILES], rounds = 0;
+    double select_time = 0;
+    for (int i = 0; i < num_quantiles; i++) ranks[i] = (long long)(quantiles[i] * (n - 1));
+    if (num_quantiles > 0) {
+        int *work = (int*)checked_malloc(local_n * sizeof(int));
+        memcpy(work, local_array, local_n * sizeof(int));
+        MPI_Barrier(MPI_COMM_WORLD);
+        double t = MPI_Wtime();
+        rounds = select_ranks(work, local_n, ranks, num_quantiles, selected, rank, MPI_COMM_WORLD);
+        select_time = MPI_Wtime() - t;
+        MPI_Allreduce(MPI_IN_PLACE, &select_time, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+        free(work);
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    double start_time = MPI_Wtime();
+    sample_sort(&local_array, &local_n, rank, size, MPI_COMM_WORLD, times);
+    double run_time = MPI_Wtime() - start_time;
+
+    if (n <= PRINT_LIMIT) print_array("Sorted array", local_array, local_n, rank, size, MPI_COMM_WORLD);
+
+    int ok = check_sorted(local_array, local_n, n, rank, size, MPI_COMM_WORLD);
+
+    double index_time = 0;
+    if (num_quantiles > 0) {
+        double t = MPI_Wtime();
+        index_sorted(local_array, local_n, ranks, num_quantiles, indexed, MPI_COMM_WORLD);
+        index_time = MPI_Wtime() - t;
+        MPI_Allreduce(MPI_IN_PLACE, &index_time, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
     }
 
-    MPI_Scatter(global_array, N / size, MPI_INT, local_array, N / size, MPI_INT, 0, MPI_COMM_WORLD);
-    odd_even_sort(local_array, N / size, rank, size, MPI_COMM_WORLD);
-    MPI_Gather(local_array, N / size, MPI_INT, global_array, N / size, MPI_INT, 0, MPI_COMM_WORLD);
+    // Load balance after the redistribution, and the slowest process's phase times
+    long long max_n, local = local_n;
+    double max_time, max_times[4];
+    MPI_Reduce(&local, &max_n, 1, MPI_LONG_LONG, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&run_time, &max_time, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(times, max_times, 4, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
 
     if (rank == 0) {
-        printf("Sorted array: ");
-        for (int i = 0; i < N; i++) printf("%d ", global_array[i]);
-        printf("\n");
+        printf("Sorted %lld keys on %d processes x %d threads: %s\n", n, size, worker_threads(),
+               ok ? "correct" : "NOT SORTED");
+        printf("Time: %.3f seconds (local sort %.3f, splitters %.3f, exchange %.3f, merge %.3f)\n",
+               max_time, max_times[0], max_times[1], max_times[2], max_times[3]);
+        printf("Throughput: %.2f million keys/s\n", n / max_time / 1e6);
+        printf("Load imbalance: largest process holds %.3f x the average\n",
+               max_n / ((double)n / size));
+
+        if (num_quantiles > 0) {
+            int agree = 1;
+            for (int i = 0; i < num_quantiles; i++) {
+                printf("Quantile %g (rank %lld): selected %d, sorted %d\n", quantiles[i], ranks[i],
+                       selected[i], indexed[i]);
+                if (selected[i] != indexed[i]) agree = 0;
+            }
+            printf("Selection: %.3f seconds in %d rounds, sort-then-index: %.3f seconds (%.1fx); %s\n",
+                   select_time, rounds, max_time + index_time, (max_time + index_time) / select_time,
+                   agree ? "results match" : "RESULTS DIFFER");
+        }
     }
 
+    free(local_array);
     MPI_Finalize();
     return 0;
 }
-
@@ -1,203 +1,1701 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <math.h>
 #include <mpi.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 #define MASTER 0        // Rank of the master process
 #define MAX_ITERATIONS 1000
 #define CONVERGENCE_THRESHOLD 0.001
+#define GRID_ALIGNMENT 64   // Byte alignment of each grid allocation (one cache line)
+#define MAX_HALO_DEPTH 64
+#define TILE_CACHE_BYTES (256 * 1024)   // Working-set target of one temporal tile per thread (about L2)
+#define OMP_MIN_POINTS 16384    // Smaller updates are not worth waking the thread team
+#define GRID_MAGIC "HEATGRID"
+#define GRID_VERSION 1
+#define HEADER_BYTES 64
+#define MAX_LEVELS 16           // Multigrid levels at most
+#define SMOOTHING_SWEEPS 2      // Red-black Gauss-Seidel sweeps before and after each coarse correction
+#define COARSE_SWEEPS 50        // Red-black SOR sweeps on the coarsest multigrid level
+
+// Storage type of the grids and halo messages. Building with -DHEAT_FLOAT stores them in single
+// precision, which halves the bytes moved per sweep and per exchange; stencil sums, differences
+// and reductions are still formed in double, and grid files always hold doubles.
+#ifdef HEAT_FLOAT
+typedef float real;
+#define MPI_GRID_TYPE MPI_FLOAT
+#else
+typedef double real;
+#define MPI_GRID_TYPE MPI_DOUBLE
+#endif
+
+// Local block of the global grid owned by one process of the 2D process grid.
+// The block holds lnx x lny interior points surrounded by a halo ring of width halo;
+// halo cells on the edge of the global grid carry the fixed boundary values.
+// Interior point (i, j) of the block lives at grid[(halo + i) * ld + halo + j].
+typedef struct {
+    int nx, ny;             // Global grid size, including the boundary ring
+    int lnx, lny;           // Local interior size
+    int x0, y0;             // Global index of the first local interior point
+    int halo;               // Halo width (number of sweeps between exchanges)
+    double gap_x, gap_y;    // Distance of the last interior row / column to the far boundary in
+                            // mesh widths: 1, except on coarse multigrid levels of even grids
+    int ld;                 // Row stride of the local array (padded for alignment)
+    int rank, size;
+    int dims[2], coords[2];
+    int north, south, west, east;   // Neighbour ranks (MPI_PROC_NULL on the edge)
+    int north_west, north_east, south_west, south_east;
+    MPI_Comm comm;
+    MPI_Datatype row_type;          // halo x lny block of rows
+    MPI_Datatype column_type;       // lnx x halo block of columns, strided by ld
+    MPI_Datatype corner_type;       // halo x halo corner block
+} Domain;
+
+// One halo message: what to send to dest and where to put what arrives from source
+typedef struct {
+    int dest, source;
+    MPI_Datatype type;
+    size_t send_offset, recv_offset;
+} HaloMessage;
+
+// Header of a binary grid file. It is followed by the (nx - 2) x (ny - 2) interior of the
+// global grid as row-major doubles in native byte order; the boundary ring is implied.
+typedef struct {
+    char magic[8];          // GRID_MAGIC, not NUL-terminated
+    int32_t version;        // GRID_VERSION
+    int32_t nx, ny;         // Global grid size, including the boundary ring
+    int32_t iteration;      // Sweeps completed when the grid was written
+    double diff;            // Last global maximum difference
+    char reserved[32];      // Pads the header to HEADER_BYTES
+} GridHeader;
+
+enum { OUTPUT_NONE, OUTPUT_BINARY, OUTPUT_CSV };
+enum { SOLVER_JACOBI, SOLVER_SOR, SOLVER_MULTIGRID, SOLVER_CG };
+enum { PRECOND_NONE, PRECOND_BLOCK_JACOBI };
+
+// State of the preconditioned conjugate gradient solver for the steady state 4u - (sum of
+// neighbours) = 0 with the boundary values moved to the right-hand side. The grid itself holds
+// the iterate x; the vectors below have zero boundary halos. This is the Chronopoulos-Gear
+// formulation, whose three inner products are independent and share one reduction.
+typedef struct {
+    real *r;                // Residual b - Ax
+    real *u;                // Preconditioned residual M^-1 r
+    real *w;                // A u
+    real *p;                // Search direction
+    real *s;                // A p
+    double alpha, gamma, gamma_old, delta, rho, rho0;
+    int iterations;
+    int preconditioner;     // PRECOND_NONE or PRECOND_BLOCK_JACOBI
+} ConjugateGradient;
+
+// One level of the multigrid hierarchy: the correction u solves 4u - (sum of neighbours) = f
+// on the level's grid (f == NULL means f = 0); r holds the residual
+typedef struct {
+    Domain d;
+    real *u, *f, *r;
+} Level;
+
+typedef struct {
+    int count;
+    Level level[MAX_LEVELS];
+} Multigrid;
+
+// Checkpoint being written in the background. Checkpoints alternate between two files, and a
+// file's header is only made valid once its data is on disk, so a crash during a write
+// always leaves the previous checkpoint intact.
+typedef struct {
+    MPI_File fh;
+    MPI_Request request;
+    double *snapshot;       // Copy of the local interior, lnx x lny
+    GridHeader header;      // Written after the data has completed
+    int active;             // A write is in flight
+    int count;              // Checkpoints started so far
+} Checkpoint;
+
+// Command-line options of the solver
+typedef struct {
+    int nx, ny;             // Global grid size, including the boundary ring
+    int overlap;            // Overlap the halo exchange with the interior update
+    int halo_depth;         // Sweeps per halo exchange
+    int check_interval;     // Sweeps between convergence checks
+    int output;             // OUTPUT_BINARY, OUTPUT_CSV or OUTPUT_NONE
+    const char *output_file;
+    int checkpoint_every;   // Sweeps between checkpoints (0 = off)
+    const char *checkpoint_prefix;
+    int restart;            // Resume from the latest checkpoint
+    int solver;             // SOLVER_JACOBI, SOLVER_SOR or SOLVER_MULTIGRID
+    double omega;           // Over-relaxation factor of the SOR solver (0 = optimal)
+    int preconditioner;     // Preconditioner of the CG solver
+    double tolerance;       // Relative residual at which CG stops
+    int max_iterations;
+    const char *reference;  // Grid file to compare the result with (NULL = none)
+} Options;
+
+void print_usage(const char *program) {
+    printf("Usage: %s [NX NY] [options]\n", program);
+    printf("  --solver NAME      jacobi (default), sor (red-black SOR), multigrid (V-cycles) or cg\n");
+    printf("  --omega W          SOR over-relaxation factor (default: optimal for the grid)\n");
+    printf("  --preconditioner P none (default) or block-jacobi (CG only)\n");
+    printf("  --tolerance T      relative residual at which CG stops (default 1e-6)\n");
+    printf("  --max-iterations N iterations or V-cycles at most (default %d)\n", MAX_ITERATIONS);
+    printf("  --overlap          non-blocking halo exchange overlapped with the interior update\n");
+    printf("  --halo-depth K     exchange K ghost layers and run K sweeps per exchange (default 1)\n");
+    printf("  --check-interval C test convergence every C sweeps, reduced in the background (default 1)\n");
+    printf("  --output FORMAT    binary (one MPI-IO file, default), csv (one file per rank) or none\n");
+    printf("  --output-file PATH binary output file (default heat_output.bin)\n");
+    printf("  --checkpoint-every N  write a checkpoint in the background every N sweeps\n");
+    printf("  --checkpoint-prefix P checkpoint files are P.0 and P.1 (default heat_checkpoint)\n");
+    printf("  --restart          resume from the latest checkpoint (any process count)\n");
+    printf("  --reference PATH   report the difference to a binary grid file, e.g. a double run\n");
+}
+
+// Function to parse the command line; returns 0 on success
+int parse_options(int argc, char *argv[], Options *opt) {
+    int positional = 0;
+
+    opt->nx = 100;  // Default grid size
+    opt->ny = 100;
+    opt->overlap = 0;
+    opt->halo_depth = 1;
+    opt->check_interval = 1;
+    opt->output = OUTPUT_BINARY;
+    opt->output_file = "heat_output.bin";
+    opt->checkpoint_every = 0;
+    opt->checkpoint_prefix = "heat_checkpoint";
+    opt->restart = 0;
+    opt->solver = SOLVER_JACOBI;
+    opt->omega = 0.0;
+    opt->preconditioner = PRECOND_NONE;
+    opt->tolerance = 1e-6;
+    opt->max_iterations = MAX_ITERATIONS;
+    opt->reference = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--overlap") == 0) {
+            opt->overlap = 1;
+        } else if (strcmp(argv[i], "--halo-depth") == 0 && i + 1 < argc) {
+            opt->halo_depth = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--check-interval") == 0 && i + 1 < argc) {
+            opt->check_interval = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "binary") == 0) opt->output = OUTPUT_BINARY;
+            else if (strcmp(argv[i], "csv") == 0) opt->output = OUTPUT_CSV;
+            else if (strcmp(argv[i], "none") == 0) opt->output = OUTPUT_NONE;
+            else return 1;
+        } else if (strcmp(argv[i], "--output-file") == 0 && i + 1 < argc) {
+            opt->output_file = argv[++i];
+        } else if (strcmp(argv[i], "--checkpoint-every") == 0 && i + 1 < argc) {
+            opt->checkpoint_every = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--checkpoint-prefix") == 0 && i + 1 < argc) {
+            opt->checkpoint_prefix = argv[++i];
+        } else if (strcmp(argv[i], "--restart") == 0) {
+            opt->restart = 1;
+        } else if (strcmp(argv[i], "--solver") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "jacobi") == 0) opt->solver = SOLVER_JACOBI;
+            else if (strcmp(argv[i], "sor") == 0) opt->solver = SOLVER_SOR;
+            else if (strcmp(argv[i], "multigrid") == 0) opt->solver = SOLVER_MULTIGRID;
+            else if (strcmp(argv[i], "cg") == 0) opt->solver = SOLVER_CG;
+            else return 1;
+        } else if (strcmp(argv[i], "--preconditioner") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "none") == 0) opt->preconditioner = PRECOND_NONE;
+            else if (strcmp(argv[i], "block-jacobi") == 0) opt->preconditioner = PRECOND_BLOCK_JACOBI;
+            else return 1;
+        } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+            opt->tolerance = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--omega") == 0 && i + 1 < argc) {
+            opt->omega = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--max-iterations") == 0 && i + 1 < argc) {
+            opt->max_iterations = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--reference") == 0 && i + 1 < argc) {
+            opt->reference = argv[++i];
+        } else if (argv[i][0] != '-' && positional < 2) {
+            if (positional++ == 0) opt->nx = atoi(argv[i]);
+            else opt->ny = atoi(argv[i]);
+        } else {
+            return 1;
+        }
+    }
+    if (opt->halo_depth < 1 || opt->halo_depth > MAX_HALO_DEPTH) return 1;
+    if (opt->check_interval < 1 || opt->checkpoint_every < 0 || opt->max_iterations < 0) return 1;
+    if (opt->omega < 0.0 || opt->omega >= 2.0 || opt->tolerance <= 0.0) return 1;
+    // Deep halos and the overlapped exchange are specific to the Jacobi sweep
+    if (opt->solver != SOLVER_JACOBI && (opt->halo_depth > 1 || opt->overlap)) return 1;
+    return (opt->nx < 3 || opt->ny < 3) ? 1 : 0;
+}
+
+// Function to split n points into p nearly equal blocks; block r gets [*start, *start + *count)
+void block_range(int n, int p, int r, int *start, int *count) {
+    int base = n / p;
+    int remainder = n % p;
+    *count = base + (r < remainder ? 1 : 0);
+    *start = r * base + (r < remainder ? r : remainder);
+}
+
+// Function to look up the rank at a coordinate offset, MPI_PROC_NULL outside the process grid
+int neighbour_rank(const Domain *d, int dx, int dy) {
+    int coords[2] = {d->coords[0] + dx, d->coords[1] + dy};
+    int rank;
+
+    if (coords[0] < 0 || coords[0] >= d->dims[0] || coords[1] < 0 || coords[1] >= d->dims[1]) {
+        return MPI_PROC_NULL;
+    }
+    MPI_Cart_rank(d->comm, coords, &rank);
+    return rank;
+}
+
+// Function to pick the padded row stride and build the halo datatypes of a local block
+void build_block_layout(Domain *d) {
+    int halo = d->halo;
+
+    // Pad rows so every row starts on an aligned boundary
+    int per_line = GRID_ALIGNMENT / sizeof(real);
+    d->ld = (d->lny + 2 * halo + per_line - 1) / per_line * per_line;
+
+    MPI_Type_vector(halo, d->lny, d->ld, MPI_GRID_TYPE, &d->row_type);
+    MPI_Type_commit(&d->row_type);
+    MPI_Type_vector(d->lnx, halo, d->ld, MPI_GRID_TYPE, &d->column_type);
+    MPI_Type_commit(&d->column_type);
+    MPI_Type_vector(halo, halo, d->ld, MPI_GRID_TYPE, &d->corner_type);
+    MPI_Type_commit(&d->corner_type);
+}
+
+// Function to build the 2D Cartesian process grid and describe the local block
+void setup_domain(Domain *d, int nx, int ny, int halo) {
+    int periods[2] = {0, 0};
+    int world_size;
+
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+    d->dims[0] = d->dims[1] = 0;
+    MPI_Dims_create(world_size, 2, d->dims);
+    MPI_Cart_create(MPI_COMM_WORLD, 2, d->dims, periods, 1, &d->comm);
+    MPI_Comm_rank(d->comm, &d->rank);
+    MPI_Comm_size(d->comm, &d->size);
+    MPI_Cart_coords(d->comm, d->rank, 2, d->coords);
+    MPI_Cart_shift(d->comm, 0, 1, &d->north, &d->south);
+    MPI_Cart_shift(d->comm, 1, 1, &d->west, &d->east);
+    d->north_west = neighbour_rank(d, -1, -1);
+    d->north_east = neighbour_rank(d, -1, 1);
+    d->south_west = neighbour_rank(d, 1, -1);
+    d->south_east = neighbour_rank(d, 1, 1);
+
+    d->nx = nx;
+    d->ny = ny;
+    d->halo = halo;
+    d->gap_x = 1.0;
+    d->gap_y = 1.0;
+    block_range(nx - 2, d->dims[0], d->coords[0], &d->x0, &d->lnx);
+    block_range(ny - 2, d->dims[1], d->coords[1], &d->y0, &d->lny);
+    d->x0 += 1;
+    d->y0 += 1;
+
+    build_block_layout(d);
+}
+
+// Function to describe the next coarser multigrid level of a domain with a one-cell halo.
+// Coarse point I of the global interior sits on fine point 2I, so an interior of n points has
+// n / 2 coarse points and the boundary stays where it is. With n even the last coarse point is
+// the last fine point and the gap to the boundary halves; with n odd the last fine point lies
+// between the last coarse point and the boundary. Every process keeps the coarse points that
+// fall inside its own fine block.
+void coarsen_domain(const Domain *fine, Domain *coarse) {
+    *coarse = *fine;
+    MPI_Comm_dup(fine->comm, &coarse->comm);
+
+    coarse->nx = (fine->nx - 2) / 2 + 2;
+    coarse->ny = (fine->ny - 2) / 2 + 2;
+    coarse->gap_x = (fine->nx % 2 == 1 ? 1.0 + fine->gap_x : fine->gap_x) / 2.0;
+    coarse->gap_y = (fine->ny % 2 == 1 ? 1.0 + fine->gap_y : fine->gap_y) / 2.0;
+    coarse->x0 = (fine->x0 + 1) / 2;
+    coarse->y0 = (fine->y0 + 1) / 2;
+    coarse->lnx = (fine->x0 + fine->lnx - 1) / 2 - coarse->x0 + 1;
+    coarse->lny = (fine->y0 + fine->lny - 1) / 2 - coarse->y0 + 1;
+    coarse->halo = 1;
+
+    build_block_layout(coarse);
+}
+
+void free_domain(Domain *d) {
+    MPI_Type_free(&d->row_type);
+    MPI_Type_free(&d->column_type);
+    MPI_Type_free(&d->corner_type);
+    MPI_Comm_free(&d->comm);
+}
+
+// Function to allocate one contiguous, aligned local grid including its halo ring
+real *alloc_grid(const Domain *d) {
+    size_t bytes = (size_t)(d->lnx + 2 * d->halo) * d->ld * sizeof(real);
+    void *ptr = NULL;
+#ifdef _WIN32
+    ptr = _aligned_malloc(bytes, GRID_ALIGNMENT);
+#else
+    if (posix_memalign(&ptr, GRID_ALIGNMENT, bytes) != 0) ptr = NULL;
+#endif
+    if (ptr == NULL) {
+        fprintf(stderr, "Process %d: Memory allocation failed\n", d->rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    return (real*)ptr;
+}
+
+void free_grid(real *grid) {
+#ifdef _WIN32
+    _aligned_free(grid);
+#else
+    free(grid);
+#endif
+}
 
 // Function to initialize the temperature grid
-void initialize_grid(double **grid, int rows, int cols, int rank, int size) {
+void initialize_grid(real *grid, const Domain *d) {
+    int ld = d->ld, h = d->halo;
+    int rows = d->lnx + 2 * h, cols = d->lny + 2 * h;
+
     for (int i = 0; i < rows; i++) {
-        for (int j = 0; j < cols; j++) {
-            grid[i][j] = 0.0;  // Initialize interior to 0
+        for (int j = 0; j < ld; j++) {
+            grid[i * ld + j] = 0.0;  // Initialize interior to 0
         }
     }
-    
-    // Set boundary conditions
-    if (rank == 0) {
-        // Top boundary (hot)
-        for (int j = 0; j < cols; j++) {
-            grid[0][j] = 100.0;
+
+    // Set boundary conditions on the halo cells that lie on the global edge
+    for (int k = 0; k < h; k++) {
+        if (d->north == MPI_PROC_NULL) {
+            // Top boundary (hot)
+            for (int j = 0; j < cols; j++) {
+                grid[k * ld + j] = 100.0;
+            }
         }
-    }
-    
-    if (rank == size - 1) {
-        // Bottom boundary (cold)
-        for (int j = 0; j < cols; j++) {
-            grid[rows-1][j] = 0.0;
+
+        if (d->south == MPI_PROC_NULL) {
+            // Bottom boundary (cold)
+            for (int j = 0; j < cols; j++) {
+                grid[(h + d->lnx + k) * ld + j] = 0.0;
+            }
         }
     }
-    
-    // Left boundary (warm)
-    for (int i = 0; i < rows; i++) {
-        grid[i][0] = 75.0;
-    }
-    
-    // Right boundary (cool)
+
     for (int i = 0; i < rows; i++) {
-        grid[i][cols-1] = 25.0;
+        for (int k = 0; k < h; k++) {
+            if (d->west == MPI_PROC_NULL) {
+                grid[i * ld + k] = 75.0;  // Left boundary (warm)
+            }
+            if (d->east == MPI_PROC_NULL) {
+                grid[i * ld + h + d->lny + k] = 25.0;  // Right boundary (cool)
+            }
+        }
     }
 }
 
-// Function to compute the new temperature at each point
-double compute_iteration(double **current, double **next, int rows, int cols) {
+// Function to get the number of threads that share the work of one process
+int worker_threads(void) {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+// Function to get the instruction set the stencil kernel was compiled for
+const char *kernel_isa(void) {
+#if defined(__AVX512F__)
+    return "AVX-512";
+#elif defined(__AVX2__)
+    return "AVX2";
+#else
+    return "scalar";
+#endif
+}
+
+// Vector loads and stores of grid values as doubles. Single-precision grids are widened on load
+// and rounded to float once per point; ROUND leaves the stored value in the register, so the
+// change is measured against what was actually stored, exactly as in the scalar loop.
+#ifdef HEAT_FLOAT
+#define LOAD8(p) _mm512_cvtps_pd(_mm256_loadu_ps(p))
+#define STORE8(p, v) _mm256_storeu_ps(p, _mm512_cvtpd_ps(v))
+#define ROUND8(v) _mm512_cvtps_pd(_mm512_cvtpd_ps(v))
+#define LOAD4(p) _mm256_cvtps_pd(_mm_loadu_ps(p))
+#define STORE4(p, v) _mm_storeu_ps(p, _mm256_cvtpd_ps(v))
+#define ROUND4(v) _mm256_cvtps_pd(_mm256_cvtpd_ps(v))
+#else
+#define LOAD8(p) _mm512_loadu_pd(p)
+#define STORE8(p, v) _mm512_storeu_pd(p, v)
+#define ROUND8(v) (v)
+#define LOAD4(p) _mm256_loadu_pd(p)
+#define STORE4(p, v) _mm256_storeu_pd(p, v)
+#define ROUND4(v) (v)
+#endif
+
+// Function to update points [j0, j1] of one row from the rows above and below. The sum is
+// formed in double in the same order in every code path, so the vector kernels are
+// bit-identical to the scalar loop. With want_diff the maximum change is kept in vector
+// registers and reduced once.
+double update_row(const real *up, const real *mid, const real *down, real *restrict out,
+                  int j0, int j1, int want_diff) {
     double max_diff = 0.0;
-    
-    // Update interior points
-    for (int i = 1; i < rows - 1; i++) {
-        for (int j = 1; j < cols - 1; j++) {
-            // Average of 4 neighbors
-            next[i][j] = 0.25 * (current[i+1][j] + current[i-1][j] +
-                                  current[i][j+1] + current[i][j-1]);
-                                  
-            double diff = fabs(next[i][j] - current[i][j]);
+    int j = j0;
+
+#if defined(__AVX512F__)
+    __m512d quarter = _mm512_set1_pd(0.25);
+    __m512d vmax = _mm512_setzero_pd();
+    for (; j + 7 <= j1; j += 8) {
+        __m512d sum = _mm512_add_pd(LOAD8(down + j), LOAD8(up + j));
+        sum = _mm512_add_pd(sum, LOAD8(mid + j + 1));
+        sum = _mm512_add_pd(sum, LOAD8(mid + j - 1));
+        __m512d value = ROUND8(_mm512_mul_pd(quarter, sum));
+        STORE8(out + j, value);
+        if (want_diff) {
+            __m512d diff = _mm512_abs_pd(_mm512_sub_pd(value, LOAD8(mid + j)));
+            vmax = _mm512_max_pd(vmax, diff);
+        }
+    }
+    if (want_diff) max_diff = _mm512_reduce_max_pd(vmax);
+#elif defined(__AVX2__)
+    __m256d quarter = _mm256_set1_pd(0.25);
+    __m256d sign = _mm256_set1_pd(-0.0);
+    __m256d vmax = _mm256_setzero_pd();
+    for (; j + 3 <= j1; j += 4) {
+        __m256d sum = _mm256_add_pd(LOAD4(down + j), LOAD4(up + j));
+        sum = _mm256_add_pd(sum, LOAD4(mid + j + 1));
+        sum = _mm256_add_pd(sum, LOAD4(mid + j - 1));
+        __m256d value = ROUND4(_mm256_mul_pd(quarter, sum));
+        STORE4(out + j, value);
+        if (want_diff) {
+            __m256d diff = _mm256_andnot_pd(sign, _mm256_sub_pd(value, LOAD4(mid + j)));
+            vmax = _mm256_max_pd(vmax, diff);
+        }
+    }
+    if (want_diff) {
+        __m128d half = _mm_max_pd(_mm256_castpd256_pd128(vmax), _mm256_extractf128_pd(vmax, 1));
+        half = _mm_max_sd(half, _mm_unpackhi_pd(half, half));
+        max_diff = _mm_cvtsd_f64(half);
+    }
+#endif
+
+    // Scalar loop: the whole row without SIMD, otherwise the remainder
+    for (; j <= j1; j++) {
+        // Average of 4 neighbors
+        out[j] = (real)(0.25 * ((double)down[j] + up[j] + mid[j + 1] + mid[j - 1]));
+
+        if (want_diff) {
+            double diff = fabs((double)out[j] - mid[j]);
             if (diff > max_diff) {
                 max_diff = diff;
             }
         }
     }
-    
-    // Preserve boundary conditions
-    for (int j = 0; j < cols; j++) {
-        next[0][j] = current[0][j];
-        next[rows-1][j] = current[rows-1][j];
+    return max_diff;
+}
+
+// Function to update the rectangle of points [i0, i1] x [j0, j1] (inclusive array indices),
+// with the rows shared among the threads of the process.
+// The maximum change is only tracked when want_diff is set; otherwise 0 is returned.
+double update_block(const real *restrict current, real *restrict next, int ld,
+                    int i0, int i1, int j0, int j1, int want_diff) {
+    double max_diff = 0.0;
+
+    #pragma omp parallel for reduction(max:max_diff) schedule(static) if ((long)(i1 - i0 + 1) * (j1 - j0 + 1) >= OMP_MIN_POINTS)
+    for (int i = i0; i <= i1; i++) {
+        double diff = update_row(current + (i - 1) * ld, current + i * ld, current + (i + 1) * ld,
+                                 next + i * ld, j0, j1, want_diff);
+        if (diff > max_diff) {
+            max_diff = diff;
+        }
     }
-    for (int i = 0; i < rows; i++) {
-        next[i][0] = current[i][0];
-        next[i][cols-1] = current[i][cols-1];
+
+    return max_diff;
+}
+
+// Function to get the rows and columns updated by a sweep that still has ext sweeps after it
+// in the current block: the interior grown by ext cells towards every neighbouring block
+void sweep_region(const Domain *d, int ext, int *i0, int *i1, int *j0, int *j1) {
+    int h = d->halo;
+    *i0 = h - (d->north != MPI_PROC_NULL ? ext : 0);
+    *i1 = h + d->lnx - 1 + (d->south != MPI_PROC_NULL ? ext : 0);
+    *j0 = h - (d->west != MPI_PROC_NULL ? ext : 0);
+    *j1 = h + d->lny - 1 + (d->east != MPI_PROC_NULL ? ext : 0);
+}
+
+// Function to advance sweeps first..steps of a block of steps sweeps that share one halo exchange.
+// Sweep s updates the interior plus (steps - s) redundant halo layers, so every value it reads
+// is either fresh from the exchange or was produced by sweep s - 1. Rows are processed as a
+// skewed wavefront of cache-sized tiles: tile c of sweep s runs right after tile c + 1 of sweep
+// s - 1, so all sweeps of the block pass over a tile while it is still in cache. Returns the
+// maximum change of the last sweep over the owned interior (0 unless want_diff is set) and
+// leaves the result in *current.
+double advance_steps(real **current, real **next, const Domain *d, int steps, int first,
+                     int want_diff) {
+    int i0[MAX_HALO_DEPTH + 1], i1[MAX_HALO_DEPTH + 1];
+    int j0[MAX_HALO_DEPTH + 1], j1[MAX_HALO_DEPTH + 1];
+    real *buffers[2] = {*current, *next};
+    int count = steps - first + 1;
+    double max_diff = 0.0;
+
+    for (int s = first; s <= steps; s++) {
+        sweep_region(d, steps - s, &i0[s], &i1[s], &j0[s], &j1[s]);
+    }
+
+    // The first sweep covers the tallest region; later sweeps only shrink inside it
+    int base = i0[first];
+    int rows = i1[first] - base + 1;
+    // Each thread works on its own rows of a tile, so the tile grows with the thread count
+    int tile = worker_threads() * (TILE_CACHE_BYTES / (2 * count * d->ld * (int)sizeof(real)));
+    if (tile < 1) tile = 1;
+    int tiles = (rows + tile - 1) / tile;
+
+    for (int front = 0; front < tiles + count - 1; front++) {
+        for (int s = first; s <= steps; s++) {
+            int c = front - (s - first);
+            if (c < 0 || c >= tiles) continue;
+
+            int r0 = base + c * tile;
+            int r1 = r0 + tile - 1;
+            if (r0 < i0[s]) r0 = i0[s];
+            if (r1 > i1[s]) r1 = i1[s];
+            if (r0 > r1) continue;
+
+            double diff = update_block(buffers[(s - first) % 2], buffers[(s - first + 1) % 2],
+                                       d->ld, r0, r1, j0[s], j1[s], want_diff && s == steps);
+            if (diff > max_diff) max_diff = diff;
+        }
+    }
+
+    if (count % 2 == 1) {
+        *current = buffers[1];
+        *next = buffers[0];
     }
-    
     return max_diff;
 }
 
-// Function to exchange ghost rows between processes
-void exchange_ghost_rows(double **grid, int rows, int cols, int rank, int size) {
-    MPI_Status status;
-    
-    // Send bottom row to next process and receive top ghost row from previous process
-    if (rank < size - 1) {
-        MPI_Send(grid[rows-2], cols, MPI_DOUBLE, rank+1, 0, MPI_COMM_WORLD);
+// Function to list the halo messages of a block: the four edges, plus the four corners if
+// requested (a single 5-point sweep never reads a corner, several sweeps per exchange and the
+// multigrid transfers do)
+int halo_messages(const Domain *d, HaloMessage msg[8], int corners) {
+    size_t ld = d->ld, h = d->halo, lnx = d->lnx, lny = d->lny;
+    int count = 0;
+
+    // Message k travels in one direction: it is sent to dest and received from the opposite side
+    msg[count++] = (HaloMessage){d->south, d->north, d->row_type, lnx * ld + h, h};
+    msg[count++] = (HaloMessage){d->north, d->south, d->row_type, h * ld + h, (h + lnx) * ld + h};
+    msg[count++] = (HaloMessage){d->east, d->west, d->column_type, h * ld + lny, h * ld};
+    msg[count++] = (HaloMessage){d->west, d->east, d->column_type, h * ld + h, h * ld + h + lny};
+    if (corners) {
+        msg[count++] = (HaloMessage){d->south_east, d->north_west, d->corner_type,
+                                     lnx * ld + lny, 0};
+        msg[count++] = (HaloMessage){d->north_west, d->south_east, d->corner_type,
+                                     h * ld + h, (h + lnx) * ld + h + lny};
+        msg[count++] = (HaloMessage){d->south_west, d->north_east, d->corner_type,
+                                     lnx * ld + h, h + lny};
+        msg[count++] = (HaloMessage){d->north_east, d->south_west, d->corner_type,
+                                     h * ld + lny, (h + lnx) * ld};
     }
-    if (rank > 0) {
-        MPI_Recv(grid[0], cols, MPI_DOUBLE, rank-1, 0, MPI_COMM_WORLD, &status);
+    return count;
+}
+
+// Function to exchange the halo with the Cartesian neighbours, corners included if requested
+void exchange_halo(real *grid, const Domain *d, int corners) {
+    HaloMessage msg[8];
+    int count = halo_messages(d, msg, corners);
+
+    for (int k = 0; k < count; k++) {
+        MPI_Sendrecv(grid + msg[k].send_offset, 1, msg[k].type, msg[k].dest, k,
+                     grid + msg[k].recv_offset, 1, msg[k].type, msg[k].source, k,
+                     d->comm, MPI_STATUS_IGNORE);
     }
-    
-    // Send top row to previous process and receive bottom ghost row from next process
-    if (rank > 0) {
-        MPI_Send(grid[1], cols, MPI_DOUBLE, rank-1, 1, MPI_COMM_WORLD);
+}
+
+// Function to exchange halo rows and columns with the Cartesian neighbours
+void exchange_ghost_rows(real *grid, const Domain *d) {
+    exchange_halo(grid, d, d->halo > 1);
+}
+
+// Function to post a non-blocking halo exchange; returns the number of requests to wait for
+int start_ghost_exchange(real *grid, const Domain *d, MPI_Request requests[16]) {
+    HaloMessage msg[8];
+    int count = halo_messages(d, msg, d->halo > 1);
+
+    // Post all receives before the sends so no message has to be buffered
+    for (int k = 0; k < count; k++) {
+        MPI_Irecv(grid + msg[k].recv_offset, 1, msg[k].type, msg[k].source, k,
+                  d->comm, &requests[k]);
+    }
+    for (int k = 0; k < count; k++) {
+        MPI_Isend(grid + msg[k].send_offset, 1, msg[k].type, msg[k].dest, k,
+                  d->comm, &requests[count + k]);
+    }
+    return 2 * count;
+}
+
+// Function to update the part of [i0, i1] x [j0, j1] outside the inner rectangle
+// [ii0, ii1] x [ij0, ij1], which must lie inside it (an empty inner rectangle is allowed)
+double update_ring(const real *restrict current, real *restrict next, int ld,
+                   int i0, int i1, int j0, int j1, int ii0, int ii1, int ij0, int ij1,
+                   int want_diff) {
+    if (ii0 > ii1 || ij0 > ij1) {
+        return update_block(current, next, ld, i0, i1, j0, j1, want_diff);
+    }
+
+    double max_diff = update_block(current, next, ld, i0, ii0 - 1, j0, j1, want_diff);
+    double diff = update_block(current, next, ld, ii1 + 1, i1, j0, j1, want_diff);
+    if (diff > max_diff) max_diff = diff;
+    diff = update_block(current, next, ld, ii0, ii1, j0, ij0 - 1, want_diff);
+    if (diff > max_diff) max_diff = diff;
+    diff = update_block(current, next, ld, ii0, ii1, ij1 + 1, j1, want_diff);
+    return diff > max_diff ? diff : max_diff;
+}
+
+// Function to run a block of sweeps with the halo exchange hidden behind the first sweep's
+// interior update; the later sweeps of the block need no communication
+double advance_overlapped(real **current, real **next, const Domain *d, int steps,
+                          int want_diff) {
+    MPI_Request requests[16];
+    int h = d->halo, ld = d->ld;
+    int i0, i1, j0, j1;
+
+    int count = start_ghost_exchange(*current, d, requests);
+
+    // Points at least one cell away from the halo do not need the incoming data
+    int ii0 = h + 1, ii1 = h + d->lnx - 2;
+    int ij0 = h + 1, ij1 = h + d->lny - 2;
+    int first_diff = want_diff && steps == 1;
+    double max_diff = 0.0;
+    if (ii0 <= ii1 && ij0 <= ij1) {
+        max_diff = update_block(*current, *next, ld, ii0, ii1, ij0, ij1, first_diff);
+    }
+
+    MPI_Waitall(count, requests, MPI_STATUSES_IGNORE);
+
+    sweep_region(d, steps - 1, &i0, &i1, &j0, &j1);
+    double diff = update_ring(*current, *next, ld, i0, i1, j0, j1, ii0, ii1, ij0, ij1, first_diff);
+    if (diff > max_diff) max_diff = diff;
+
+    real *temp = *current;
+    *current = *next;
+    *next = temp;
+
+    return steps > 1 ? advance_steps(current, next, d, steps, 2, want_diff) : max_diff;
+}
+
+// Function to get the optimal SOR factor of the model problem on an nx x ny grid
+double optimal_omega(int nx, int ny) {
+    int n = (nx > ny ? nx : ny) - 1;
+    return 2.0 / (1.0 + sin(acos(-1.0) / n));
+}
+
+// Function to apply the 5-point operator at point p whose south or east neighbour is the
+// boundary only gx or gy mesh widths away (the last row or column of a coarse level of an even
+// grid). That neighbour weighs 1 / g and the stencil along the axis is scaled by 2 / (1 + g),
+// the second difference for unequal spacings; *diag gets the diagonal, 4 when gx = gy = 1.
+double stretched_operator(const real *p, int ld, double gx, double gy, double *diag) {
+    double cx = 2.0 / (1.0 + gx), cy = 2.0 / (1.0 + gy);
+
+    *diag = cx * (1.0 + 1.0 / gx) + cy * (1.0 + 1.0 / gy);
+    return *diag * p[0] - cx * (p[-ld] + p[ld] / gx) - cy * (p[-1] + p[1] / gy);
+}
+
+// Function to get the local index (halo included) of the last global column if it is stretched
+// and owned by this process, -1 otherwise
+int stretched_column(const Domain *d) {
+    return d->gap_y != 1.0 && d->y0 + d->lny == d->ny - 1 ? d->halo + d->lny - 1 : -1;
+}
+
+// Function to relax the points of one colour, (i + j) % 2 == colour in global indices, with
+// over-relaxation factor omega; the other colour is only read, so the update is in place
+double relax_colour(real *u, const real *f, const Domain *d, int colour, double omega,
+                    int want_diff) {
+    int ld = d->ld, h = d->halo;
+    int last_column = stretched_column(d);
+    double max_diff = 0.0;
+
+    #pragma omp parallel for reduction(max:max_diff) schedule(static) if ((long)d->lnx * d->lny >= OMP_MIN_POINTS)
+    for (int i = h; i < h + d->lnx; i++) {
+        int gi = d->x0 + i - h;
+        real *row = u + i * ld;
+        const real *up = row - ld;
+        const real *down = row + ld;
+        const real *rhs = f != NULL ? f + i * ld : NULL;
+        double gx = gi == d->nx - 2 ? d->gap_x : 1.0;
+
+        for (int j = h + ((colour + gi + d->y0) & 1); j < h + d->lny; j += 2) {
+            real value;
+            if (gx != 1.0 || j == last_column) {
+                double diag, res = (rhs != NULL ? rhs[j] : 0.0) -
+                    stretched_operator(row + j, ld, gx, j == last_column ? d->gap_y : 1.0, &diag);
+                value = (real)(row[j] + omega * res / diag);
+            } else {
+                double sum = (double)up[j] + down[j] + row[j - 1] + row[j + 1];
+                if (rhs != NULL) sum += rhs[j];
+                value = (real)(row[j] + omega * (0.25 * sum - row[j]));
+            }
+
+            if (want_diff) {
+                double diff = fabs((double)value - row[j]);
+                if (diff > max_diff) max_diff = diff;
+            }
+            row[j] = value;
+        }
+    }
+    return max_diff;
+}
+
+// Function to run one red-black SOR iteration; each colour needs the other's fresh halo
+double sor_iteration(real *u, const real *f, const Domain *d, double omega, int want_diff) {
+    exchange_ghost_rows(u, d);
+    double max_diff = relax_colour(u, f, d, 0, omega, want_diff);
+    exchange_ghost_rows(u, d);
+    double diff = relax_colour(u, f, d, 1, omega, want_diff);
+    return diff > max_diff ? diff : max_diff;
+}
+
+// Function to compute r = f - (4u - sum of neighbours) on the interior; the halo of u must be current
+void compute_residual(const Level *level) {
+    const Domain *d = &level->d;
+    int ld = d->ld;
+    int last_column = stretched_column(d);
+
+    #pragma omp parallel for schedule(static) if ((long)d->lnx * d->lny >= OMP_MIN_POINTS)
+    for (int i = 1; i <= d->lnx; i++) {
+        const real *row = level->u + i * ld;
+        real *r = level->r + i * ld;
+        double gx = d->x0 + i - 1 == d->nx - 2 ? d->gap_x : 1.0;
+        for (int j = 1; j <= d->lny; j++) {
+            double diag, res;
+            if (gx != 1.0 || j == last_column) {
+                res = -stretched_operator(row + j, ld, gx, j == last_column ? d->gap_y : 1.0, &diag);
+            } else {
+                res = (double)row[j - ld] + row[j + ld] + row[j - 1] + row[j + 1] - 4.0 * row[j];
+            }
+            if (level->f != NULL) res += level->f[i * ld + j];
+            r[j] = (real)res;
+        }
+    }
+}
+
+// Function to get the interpolation weight of coarse point g / 2 for fine point g of an
+// interior of n points with the given boundary gap; coarse point g / 2 + 1 gets the rest. The
+// last fine point of an odd interior lies between the last coarse point, half a coarse mesh
+// width away, and the boundary, gap fine mesh widths away.
+double lower_weight(int g, int n, double gap) {
+    return g == n && n % 2 == 1 ? gap / (1.0 + gap) : 0.5;
+}
+
+// Function to restrict the fine residual to the coarse right-hand side by full weighting (the
+// transpose of the prolongation) and clear the coarse correction. The factor 4 of the doubled
+// mesh width cancels the 1 / 4 of the weights; the fine residual halo, corners included, must
+// be current.
+void restrict_residual(const Level *fine, Level *coarse) {
+    const Domain *fd = &fine->d, *cd = &coarse->d;
+    int fld = fd->ld, cld = cd->ld;
+
+    for (int ic = 1; ic <= cd->lnx; ic++) {
+        int gi = 2 * (cd->x0 + ic - 1);
+        const real *r = fine->r + (1 + gi - fd->x0) * fld;
+        double wx = lower_weight(gi + 1, fd->nx - 2, fd->gap_x);
+        for (int jc = 1; jc <= cd->lny; jc++) {
+            int gj = 2 * (cd->y0 + jc - 1);
+            int j = 1 + gj - fd->y0;
+            double wy = lower_weight(gj + 1, fd->ny - 2, fd->gap_y);
+            double north = 0.5 * r[j - fld - 1] + r[j - fld] + wy * r[j - fld + 1];
+            double centre = 0.5 * r[j - 1] + r[j] + wy * r[j + 1];
+            double south = 0.5 * r[j + fld - 1] + r[j + fld] + wy * r[j + fld + 1];
+
+            coarse->f[ic * cld + jc] = (real)(0.5 * north + centre + wx * south);
+            coarse->u[ic * cld + jc] = 0.0;
+        }
     }
-    if (rank < size - 1) {
-        MPI_Recv(grid[rows-1], cols, MPI_DOUBLE, rank+1, 1, MPI_COMM_WORLD, &status);
+}
+
+// Function to add the bilinear interpolation of the coarse correction to the fine grid; the
+// coarse halo, corners included, must be current
+void prolongate_correction(const Level *coarse, Level *fine) {
+    const Domain *fd = &fine->d, *cd = &coarse->d;
+    int fld = fd->ld, cld = cd->ld;
+
+    for (int i = 1; i <= fd->lnx; i++) {
+        // An even fine index sits on a coarse point, an odd one between two
+        int gi = fd->x0 + i - 1;
+        const real *c0 = coarse->u + (gi / 2 - cd->x0 + 1) * cld;
+        const real *c1 = coarse->u + ((gi + 1) / 2 - cd->x0 + 1) * cld;
+        real *u = fine->u + i * fld;
+        double a0 = lower_weight(gi, fd->nx - 2, fd->gap_x), a1 = 1.0 - a0;
+
+        for (int j = 1; j <= fd->lny; j++) {
+            int gj = fd->y0 + j - 1;
+            int j0 = gj / 2 - cd->y0 + 1;
+            int j1 = (gj + 1) / 2 - cd->y0 + 1;
+            double b0 = lower_weight(gj, fd->ny - 2, fd->gap_y), b1 = 1.0 - b0;
+            u[j] = (real)(u[j] + a0 * (b0 * c0[j0] + b1 * c0[j1]) + a1 * (b0 * c1[j0] + b1 * c1[j1]));
+        }
     }
 }
 
-// Function to save the final temperature grid to a file
-void save_grid(double **grid, int rows, int cols, int rank, int size) {
+// Function to build the multigrid hierarchy under the fine grid u (one-cell halo). Levels are
+// added while both interior sizes are at least 3 and every process keeps at least one coarse
+// point.
+void setup_multigrid(Multigrid *mg, const Domain *fine, real *u) {
+    mg->count = 1;
+    mg->level[0].d = *fine;
+    mg->level[0].u = u;
+    mg->level[0].f = NULL;
+    mg->level[0].r = alloc_grid(fine);
+    memset(mg->level[0].r, 0, (size_t)(fine->lnx + 2) * fine->ld * sizeof(real));
+
+    while (mg->count < MAX_LEVELS) {
+        const Domain *d = &mg->level[mg->count - 1].d;
+        int n = d->nx - 2, m = d->ny - 2;
+        int local_ok = n >= 3 && m >= 3 &&
+                       (d->x0 + d->lnx - 1) / 2 >= (d->x0 + 1) / 2 &&
+                       (d->y0 + d->lny - 1) / 2 >= (d->y0 + 1) / 2;
+        int all_ok;
+        MPI_Allreduce(&local_ok, &all_ok, 1, MPI_INT, MPI_MIN, d->comm);
+        if (!all_ok) break;
+
+        Level *c = &mg->level[mg->count++];
+        coarsen_domain(d, &c->d);
+        size_t bytes = (size_t)(c->d.lnx + 2) * c->d.ld * sizeof(real);
+        c->u = alloc_grid(&c->d);
+        c->f = alloc_grid(&c->d);
+        c->r = alloc_grid(&c->d);
+        // Corrections vanish on the boundary, so all halos start at zero
+        memset(c->u, 0, bytes);
+        memset(c->f, 0, bytes);
+        memset(c->r, 0, bytes);
+    }
+}
+
+void free_multigrid(Multigrid *mg) {
+    free_grid(mg->level[0].r);
+    for (int l = 1; l < mg->count; l++) {
+        free_grid(mg->level[l].u);
+        free_grid(mg->level[l].f);
+        free_grid(mg->level[l].r);
+        free_domain(&mg->level[l].d);
+    }
+}
+
+// Function to run one V-cycle from level l down: smooth, correct from the coarser level, smooth
+void v_cycle(Multigrid *mg, int l) {
+    Level *level = &mg->level[l];
+
+    if (l == mg->count - 1) {
+        // Coarsest level: relax it (nearly) to convergence
+        double omega = optimal_omega(level->d.nx, level->d.ny);
+        for (int k = 0; k < COARSE_SWEEPS; k++) {
+            sor_iteration(level->u, level->f, &level->d, omega, 0);
+        }
+        return;
+    }
+
+    Level *coarse = &mg->level[l + 1];
+    for (int k = 0; k < SMOOTHING_SWEEPS; k++) {
+        sor_iteration(level->u, level->f, &level->d, 1.0, 0);
+    }
+
+    exchange_ghost_rows(level->u, &level->d);
+    compute_residual(level);
+    exchange_halo(level->r, &level->d, 1);
+    restrict_residual(level, coarse);
+
+    v_cycle(mg, l + 1);
+
+    exchange_halo(coarse->u, &coarse->d, 1);
+    prolongate_correction(coarse, level);
+
+    for (int k = 0; k < SMOOTHING_SWEEPS; k++) {
+        sor_iteration(level->u, level->f, &level->d, 1.0, 0);
+    }
+}
+
+// Function to run one V-cycle on the fine grid. With want_diff the fine interior is copied to
+// scratch first and the maximum change over the cycle is returned.
+double multigrid_iteration(Multigrid *mg, real *scratch, int want_diff) {
+    const Domain *d = &mg->level[0].d;
+    real *u = mg->level[0].u;
+    size_t bytes = (size_t)(d->lnx + 2) * d->ld * sizeof(real);
+    double max_diff = 0.0;
+
+    if (want_diff) memcpy(scratch, u, bytes);
+    v_cycle(mg, 0);
+    if (!want_diff) return 0.0;
+
+    for (int i = 1; i <= d->lnx; i++) {
+        for (int j = 1; j <= d->lny; j++) {
+            double diff = fabs((double)u[i * d->ld + j] - scratch[i * d->ld + j]);
+            if (diff > max_diff) max_diff = diff;
+        }
+    }
+    return max_diff;
+}
+
+// Function to apply the 5-point operator, out = 4 in - (sum of neighbours), on the interior;
+// the halo of in must be current
+void apply_operator(const real *restrict in, real *restrict out, const Domain *d) {
+    int ld = d->ld;
+
+    #pragma omp parallel for schedule(static) if ((long)d->lnx * d->lny >= OMP_MIN_POINTS)
+    for (int i = 1; i <= d->lnx; i++) {
+        const real *row = in + i * ld;
+        real *result = out + i * ld;
+        for (int j = 1; j <= d->lny; j++) {
+            double sum = (double)row[j - ld] + row[j + ld] + row[j - 1] + row[j + 1];
+            result[j] = (real)(4.0 * row[j] - sum);
+        }
+    }
+}
+
+// Function to set the halo ring of a vector to zero
+void clear_halo(real *v, const Domain *d) {
+    int ld = d->ld;
+
+    for (int j = 0; j < ld; j++) {
+        v[j] = 0.0;
+        v[(d->lnx + 1) * ld + j] = 0.0;
+    }
+    for (int i = 1; i <= d->lnx; i++) {
+        v[i * ld] = 0.0;
+        v[i * ld + d->lny + 1] = 0.0;
+    }
+}
+
+// Function to apply the preconditioner, u = M^-1 r. Block Jacobi approximates the inverse of
+// each process's own block, cut off from its neighbours, by one symmetric Gauss-Seidel sweep
+// (forward, then backward) from zero, which keeps M symmetric and needs no communication.
+// There is no point-Jacobi option: the diagonal of this operator is 4 everywhere, so scaling
+// by it leaves the CG iterates unchanged.
+void apply_preconditioner(const ConjugateGradient *cg, const Domain *d) {
+    int ld = d->ld;
+    real *u = cg->u;
+    const real *r = cg->r;
+
+    if (cg->preconditioner == PRECOND_NONE) {
+        for (int i = 1; i <= d->lnx; i++) {
+            for (int j = 1; j <= d->lny; j++) {
+                u[i * ld + j] = r[i * ld + j];
+            }
+        }
+        return;
+    }
+
+    clear_halo(u, d);
+    for (int i = 1; i <= d->lnx; i++) {
+        for (int j = 1; j <= d->lny; j++) {
+            u[i * ld + j] = 0.0;
+        }
+    }
+    for (int i = 1; i <= d->lnx; i++) {
+        for (int j = 1; j <= d->lny; j++) {
+            int k = i * ld + j;
+            u[k] = (real)(0.25 * ((double)r[k] + u[k - ld] + u[k + ld] + u[k - 1] + u[k + 1]));
+        }
+    }
+    for (int i = d->lnx; i >= 1; i--) {
+        for (int j = d->lny; j >= 1; j--) {
+            int k = i * ld + j;
+            u[k] = (real)(0.25 * ((double)r[k] + u[k - ld] + u[k + ld] + u[k - 1] + u[k + 1]));
+        }
+    }
+}
+
+// Function to precondition the residual, apply the operator to the result, and reduce the
+// three inner products (r, u), (w, u) and (r, r) with a single MPI_Allreduce
+void cg_update_products(ConjugateGradient *cg, const Domain *d) {
+    int ld = d->ld;
+    double ru = 0.0, wu = 0.0, rr = 0.0;
+    double local[3], global[3];
+
+    apply_preconditioner(cg, d);
+    exchange_ghost_rows(cg->u, d);
+    apply_operator(cg->u, cg->w, d);
+
+    #pragma omp parallel for reduction(+:ru, wu, rr) schedule(static) if ((long)d->lnx * d->lny >= OMP_MIN_POINTS)
+    for (int i = 1; i <= d->lnx; i++) {
+        for (int j = 1; j <= d->lny; j++) {
+            int k = i * ld + j;
+            ru += (double)cg->r[k] * cg->u[k];
+            wu += (double)cg->w[k] * cg->u[k];
+            rr += (double)cg->r[k] * cg->r[k];
+        }
+    }
+    local[0] = ru;
+    local[1] = wu;
+    local[2] = rr;
+    MPI_Allreduce(local, global, 3, MPI_DOUBLE, MPI_SUM, d->comm);
+    cg->gamma = global[0];
+    cg->delta = global[1];
+    cg->rho = global[2];
+}
+
+// Function to set up CG from the current grid: the residual of the grid, whose halo carries
+// the boundary values, is exactly b - Ax
+void setup_cg(ConjugateGradient *cg, real *grid, const Domain *d, int preconditioner) {
+    size_t bytes = (size_t)(d->lnx + 2) * d->ld * sizeof(real);
+    real **vectors[5] = {&cg->r, &cg->u, &cg->w, &cg->p, &cg->s};
+
+    for (int k = 0; k < 5; k++) {
+        *vectors[k] = alloc_grid(d);
+        memset(*vectors[k], 0, bytes);
+    }
+    cg->preconditioner = preconditioner;
+    cg->iterations = 0;
+
+    exchange_ghost_rows(grid, d);
+    apply_operator(grid, cg->r, d);
+    for (int i = 1; i <= d->lnx; i++) {
+        for (int j = 1; j <= d->lny; j++) {
+            cg->r[i * d->ld + j] = -cg->r[i * d->ld + j];
+        }
+    }
+    cg_update_products(cg, d);
+    cg->rho0 = cg->rho;
+}
+
+void free_cg(ConjugateGradient *cg) {
+    free_grid(cg->r);
+    free_grid(cg->u);
+    free_grid(cg->w);
+    free_grid(cg->p);
+    free_grid(cg->s);
+}
+
+// Function to run one CG iteration on the interior of grid; returns the relative residual
+// ||r|| / ||r0||. One halo exchange and one reduction per iteration.
+double cg_iteration(ConjugateGradient *cg, real *grid, const Domain *d) {
+    int ld = d->ld;
+    double beta, alpha;
+
+    if (cg->rho0 == 0.0) return 0.0;
+
+    if (cg->iterations == 0) {
+        beta = 0.0;
+        alpha = cg->gamma / cg->delta;
+    } else {
+        beta = cg->gamma / cg->gamma_old;
+        alpha = cg->gamma / (cg->delta - beta * cg->gamma / cg->alpha);
+    }
+
+    #pragma omp parallel for schedule(static) if ((long)d->lnx * d->lny >= OMP_MIN_POINTS)
+    for (int i = 1; i <= d->lnx; i++) {
+        for (int j = 1; j <= d->lny; j++) {
+            int k = i * ld + j;
+            cg->p[k] = (real)(cg->u[k] + beta * cg->p[k]);
+            cg->s[k] = (real)(cg->w[k] + beta * cg->s[k]);
+            grid[k] = (real)(grid[k] + alpha * cg->p[k]);
+            cg->r[k] = (real)(cg->r[k] - alpha * cg->s[k]);
+        }
+    }
+
+    cg->alpha = alpha;
+    cg->gamma_old = cg->gamma;
+    cg_update_products(cg, d);
+    cg->iterations++;
+
+    return sqrt(cg->rho / cg->rho0);
+}
+
+// Function to get the global maximum residual |4u - sum of neighbours| of the steady state
+double residual_norm(real *grid, const Domain *d) {
+    int ld = d->ld, h = d->halo;
+    double local_max = 0.0, global_max;
+
+    exchange_ghost_rows(grid, d);
+    #pragma omp parallel for reduction(max:local_max) schedule(static) if ((long)d->lnx * d->lny >= OMP_MIN_POINTS)
+    for (int i = h; i < h + d->lnx; i++) {
+        const real *row = grid + i * ld;
+        for (int j = h; j < h + d->lny; j++) {
+            double r = fabs((double)row[j - ld] + row[j + ld] + row[j - 1] + row[j + 1] - 4.0 * row[j]);
+            if (r > local_max) local_max = r;
+        }
+    }
+    MPI_Allreduce(&local_max, &global_max, 1, MPI_DOUBLE, MPI_MAX, d->comm);
+    return global_max;
+}
+
+// Function to build the datatype that selects the local block inside the global interior
+// of a grid file
+void grid_file_type(const Domain *d, MPI_Datatype *filetype) {
+    int global_sizes[2] = {d->nx - 2, d->ny - 2};
+    int local_sizes[2] = {d->lnx, d->lny};
+    int global_starts[2] = {d->x0 - 1, d->y0 - 1};
+
+    MPI_Type_create_subarray(2, global_sizes, local_sizes, global_starts, MPI_ORDER_C,
+                             MPI_DOUBLE, filetype);
+    MPI_Type_commit(filetype);
+}
+
+// Function to copy the local interior into a contiguous lnx x lny array of doubles, the
+// layout of a block in a grid file
+void copy_interior(const real *grid, const Domain *d, double *out) {
+    for (int i = 0; i < d->lnx; i++) {
+        const real *row = grid + (size_t)(d->halo + i) * d->ld + d->halo;
+        for (int j = 0; j < d->lny; j++) {
+            out[(size_t)i * d->lny + j] = row[j];
+        }
+    }
+}
+
+// Function to copy a contiguous lnx x lny array of doubles back into the local interior
+void restore_interior(real *grid, const Domain *d, const double *in) {
+    for (int i = 0; i < d->lnx; i++) {
+        real *row = grid + (size_t)(d->halo + i) * d->ld + d->halo;
+        for (int j = 0; j < d->lny; j++) {
+            row[j] = (real)in[(size_t)i * d->lny + j];
+        }
+    }
+}
+
+// Function to allocate a contiguous buffer for the local interior as doubles
+double *alloc_interior(const Domain *d) {
+    double *buffer = (double*)malloc((size_t)d->lnx * d->lny * sizeof(double));
+    if (buffer == NULL) {
+        fprintf(stderr, "Process %d: Memory allocation failed\n", d->rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    return buffer;
+}
+
+// Function to fill in the header of a grid file
+void fill_header(GridHeader *header, const Domain *d, int iteration, double diff) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, GRID_MAGIC, sizeof(header->magic));
+    header->version = GRID_VERSION;
+    header->nx = d->nx;
+    header->ny = d->ny;
+    header->iteration = iteration;
+    header->diff = diff;
+}
+
+// Function to open a grid file for writing and size it for the header and the global interior
+int open_grid_file(const Domain *d, const char *filename, MPI_File *fh) {
+    int err = MPI_File_open(d->comm, filename, MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                            MPI_INFO_NULL, fh);
+    if (err != MPI_SUCCESS) {
+        if (d->rank == MASTER) printf("Error opening %s for writing\n", filename);
+        return 1;
+    }
+    MPI_File_set_size(*fh, HEADER_BYTES + (MPI_Offset)(d->nx - 2) * (d->ny - 2) * sizeof(double));
+    return 0;
+}
+
+// Function to write a header at the start of a grid file (collective, the master writes)
+void write_header(MPI_File fh, const Domain *d, const GridHeader *header) {
+    MPI_File_set_view(fh, 0, MPI_BYTE, MPI_BYTE, "native", MPI_INFO_NULL);
+    if (d->rank == MASTER) {
+        MPI_File_write_at(fh, 0, header, HEADER_BYTES, MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+}
+
+// Function to point the file view of every process at its block of the global interior
+void set_block_view(MPI_File fh, const Domain *d) {
+    MPI_Datatype filetype;
+
+    grid_file_type(d, &filetype);
+    MPI_File_set_view(fh, HEADER_BYTES, MPI_DOUBLE, filetype, "native", MPI_INFO_NULL);
+    MPI_Type_free(&filetype);
+}
+
+// Function to write the global interior into one binary file with a collective MPI-IO write
+int save_grid_binary(const real *grid, const Domain *d, const char *filename,
+                     int iteration, double diff) {
+    MPI_File fh;
+    GridHeader header;
+
+    if (open_grid_file(d, filename, &fh) != 0) {
+        return 1;
+    }
+
+    fill_header(&header, d, iteration, diff);
+    write_header(fh, d, &header);
+    set_block_view(fh, d);
+
+    double *buffer = alloc_interior(d);
+    copy_interior(grid, d, buffer);
+    MPI_File_write_at_all(fh, 0, buffer, d->lnx * d->lny, MPI_DOUBLE, MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+    free(buffer);
+
+    if (d->rank == MASTER) {
+        printf("Grid saved to %s (%d x %d doubles after a %d-byte header)\n",
+               filename, d->nx - 2, d->ny - 2, HEADER_BYTES);
+    }
+    return 0;
+}
+
+// Function to complete the checkpoint in flight: wait for its data, then validate its header
+void finish_checkpoint(Checkpoint *ckpt, const Domain *d) {
+    if (!ckpt->active) return;
+
+    MPI_Wait(&ckpt->request, MPI_STATUS_IGNORE);
+    MPI_File_sync(ckpt->fh);
+    write_header(ckpt->fh, d, &ckpt->header);
+    MPI_File_close(&ckpt->fh);
+    ckpt->active = 0;
+}
+
+// Function to snapshot the local interior and start writing it with non-blocking MPI-IO;
+// iteration continues on the live grid while the snapshot drains to disk
+void start_checkpoint(Checkpoint *ckpt, const real *grid, const Domain *d, const char *prefix,
+                      int iteration, double diff) {
+    char filename[256];
+    GridHeader invalid;
+
+    // The previous checkpoint has had a whole interval to complete
+    finish_checkpoint(ckpt, d);
+
+    copy_interior(grid, d, ckpt->snapshot);
+
+    snprintf(filename, sizeof(filename), "%s.%d", prefix, ckpt->count % 2);
+    if (open_grid_file(d, filename, &ckpt->fh) != 0) {
+        return;
+    }
+
+    // Invalidate the older checkpoint held in this file before its data is overwritten
+    memset(&invalid, 0, sizeof(invalid));
+    write_header(ckpt->fh, d, &invalid);
+    MPI_File_sync(ckpt->fh);
+    fill_header(&ckpt->header, d, iteration, diff);
+    set_block_view(ckpt->fh, d);
+
+    MPI_File_iwrite_at_all(ckpt->fh, 0, ckpt->snapshot, d->lnx * d->lny, MPI_DOUBLE,
+                           &ckpt->request);
+    ckpt->active = 1;
+    ckpt->count++;
+}
+
+// Function to read the header of a grid file on the master; returns 0 if it is a valid
+// grid file (output or checkpoint) of a grid of the same size
+int read_header(const char *filename, const Domain *d, GridHeader *header) {
+    MPI_File fh;
+
+    if (MPI_File_open(MPI_COMM_SELF, filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+        return 1;
+    }
+    int err = MPI_File_read_at(fh, 0, header, HEADER_BYTES, MPI_BYTE, MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+
+    if (err != MPI_SUCCESS || memcmp(header->magic, GRID_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != GRID_VERSION || header->nx != d->nx || header->ny != d->ny) {
+        return 1;
+    }
+    return 0;
+}
+
+// Function to load the latest valid checkpoint into grid. The file stores the global interior,
+// so it can be read back with any process grid. Returns 0 on success.
+int load_checkpoint(real *grid, const Domain *d, const char *prefix, int *iteration, double *diff) {
+    char filename[2][256];
+    GridHeader header[2];
+    int latest = -1;
+    MPI_File fh;
+
+    for (int k = 0; k < 2; k++) {
+        snprintf(filename[k], sizeof(filename[k]), "%s.%d", prefix, k);
+    }
+
+    if (d->rank == MASTER) {
+        for (int k = 0; k < 2; k++) {
+            if (read_header(filename[k], d, &header[k]) == 0 &&
+                (latest < 0 || header[k].iteration > header[latest].iteration)) {
+                latest = k;
+            }
+        }
+    }
+    MPI_Bcast(&latest, 1, MPI_INT, MASTER, d->comm);
+    if (latest < 0) {
+        return 1;
+    }
+    MPI_Bcast(&header[latest], HEADER_BYTES, MPI_BYTE, MASTER, d->comm);
+
+    if (MPI_File_open(d->comm, filename[latest], MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+        return 1;
+    }
+    set_block_view(fh, d);
+    double *buffer = alloc_interior(d);
+    MPI_File_read_at_all(fh, 0, buffer, d->lnx * d->lny, MPI_DOUBLE, MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+    restore_interior(grid, d, buffer);
+    free(buffer);
+
+    *iteration = header[latest].iteration;
+    *diff = header[latest].diff;
+    if (d->rank == MASTER) {
+        printf("Restarted from %s at iteration %d (maximum difference %.6f)\n",
+               filename[latest], *iteration, *diff);
+    }
+    return 0;
+}
+
+// Function to compare the grid with the one stored in a reference file, typically the binary
+// output of a double-precision run; prints the maximum and RMS difference. Returns 0 on success.
+int compare_reference(const real *grid, const Domain *d, const char *filename) {
+    GridHeader header;
+    MPI_File fh;
+    int valid = 0;
+
+    if (d->rank == MASTER) {
+        valid = read_header(filename, d, &header) == 0;
+    }
+    MPI_Bcast(&valid, 1, MPI_INT, MASTER, d->comm);
+    if (!valid || MPI_File_open(d->comm, filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+        if (d->rank == MASTER) {
+            printf("Reference %s is not a %d x %d grid file\n", filename, d->nx, d->ny);
+        }
+        return 1;
+    }
+    set_block_view(fh, d);
+    double *reference = alloc_interior(d);
+    MPI_File_read_at_all(fh, 0, reference, d->lnx * d->lny, MPI_DOUBLE, MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+
+    double local_max = 0.0, local_sum = 0.0, global_max, global_sum;
+    for (int i = 0; i < d->lnx; i++) {
+        const real *row = grid + (size_t)(d->halo + i) * d->ld + d->halo;
+        for (int j = 0; j < d->lny; j++) {
+            double error = fabs((double)row[j] - reference[(size_t)i * d->lny + j]);
+            if (error > local_max) local_max = error;
+            local_sum += error * error;
+        }
+    }
+    free(reference);
+
+    MPI_Reduce(&local_max, &global_max, 1, MPI_DOUBLE, MPI_MAX, MASTER, d->comm);
+    MPI_Reduce(&local_sum, &global_sum, 1, MPI_DOUBLE, MPI_SUM, MASTER, d->comm);
+    if (d->rank == MASTER) {
+        printf("Difference to %s: maximum %.3e, RMS %.3e\n", filename, global_max,
+               sqrt(global_sum / ((double)(d->nx - 2) * (d->ny - 2))));
+    }
+    return 0;
+}
+
+// Function to save the final temperature grid to one CSV file per process
+void save_grid(const real *grid, const Domain *d) {
     char filename[100];
-    sprintf(filename, "heat_output_rank%d.csv", rank);
-    
+    sprintf(filename, "heat_output_rank%d.csv", d->rank);
+
     FILE *fp = fopen(filename, "w");
     if (fp == NULL) {
         printf("Error opening file for writing\n");
         return;
     }
-    
-    for (int i = 0; i < rows; i++) {
-        for (int j = 0; j < cols; j++) {
-            fprintf(fp, "%.2f", grid[i][j]);
-            if (j < cols - 1) fprintf(fp, ",");
+
+    // Write the interior with the innermost halo layer around it
+    for (int i = d->halo - 1; i <= d->halo + d->lnx; i++) {
+        for (int j = d->halo - 1; j <= d->halo + d->lny; j++) {
+            fprintf(fp, "%.2f", grid[i * d->ld + j]);
+            if (j < d->halo + d->lny) fprintf(fp, ",");
         }
         fprintf(fp, "\n");
     }
-    
+
     fclose(fp);
-    printf("Process %d: Grid saved to %s\n", rank, filename);
+    printf("Process %d: Grid saved to %s\n", d->rank, filename);
 }
 
 int main(int argc, char *argv[]) {
-    int rank, size, rows, cols;
-    double **current_grid, **next_grid;
+    int rank, size, nx, ny;
+    Options opt;
+    Domain domain;
+    real *current_grid, *next_grid;
     double local_diff, global_diff;
     int iteration = 0;
     double start_time, end_time;
-    
-    // Initialize MPI
-    MPI_Init(&argc, &argv);
+
+    // Initialize MPI; only the master thread of each process communicates
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
-    
-    // Get grid dimensions from command line or use defaults
-    if (argc >= 3) {
-        rows = atoi(argv[1]) / size + 2;  // +2 for ghost rows
-        cols = atoi(argv[2]);
-    } else {
-        rows = 100 / size + 2;  // Default grid size
-        cols = 100;
+
+    // Get global grid dimensions (boundary ring included) and solver options from command line
+    if (parse_options(argc, argv, &opt) != 0) {
+        if (rank == MASTER) print_usage(argv[0]);
+        MPI_Finalize();
+        return 1;
     }
-    
-    // Allocate memory for grids
-    current_grid = (double**)malloc(rows * sizeof(double*));
-    next_grid = (double**)malloc(rows * sizeof(double*));
-    for (int i = 0; i < rows; i++) {
-        current_grid[i] = (double*)malloc(cols * sizeof(double));
-        next_grid[i] = (double*)malloc(cols * sizeof(double));
+    nx = opt.nx;
+    ny = opt.ny;
+
+    setup_domain(&domain, nx, ny, opt.halo_depth);
+    rank = domain.rank;
+
+    // Every process must own a block, and all of them have to agree before anyone stops
+    int local_empty = domain.lnx < 1 || domain.lny < 1, any_empty;
+    MPI_Allreduce(&local_empty, &any_empty, 1, MPI_INT, MPI_LOR, domain.comm);
+    if (any_empty) {
+        if (rank == MASTER) {
+            fprintf(stderr, "Grid %d x %d is too small for a %d x %d process grid\n",
+                    nx, ny, domain.dims[0], domain.dims[1]);
+        }
+        free_domain(&domain);
+        MPI_Finalize();
+        return 1;
+    }
+
+    // Every neighbour must be able to fill a halo of the requested depth from its own interior
+    int local_min = domain.lnx < domain.lny ? domain.lnx : domain.lny;
+    int global_min;
+    MPI_Allreduce(&local_min, &global_min, 1, MPI_INT, MPI_MIN, domain.comm);
+    if (global_min < opt.halo_depth) {
+        if (rank == MASTER) {
+            fprintf(stderr, "Halo depth %d exceeds the smallest local block size %d\n",
+                    opt.halo_depth, global_min);
+        }
+        free_domain(&domain);
+        MPI_Finalize();
+        return 1;
     }
-    
+
+    // Allocate memory for grids
+    current_grid = alloc_grid(&domain);
+    next_grid = alloc_grid(&domain);
+
     // Initialize the temperature grid
-    initialize_grid(current_grid, rows, cols, rank, size);
-    initialize_grid(next_grid, rows, cols, rank, size);
-    
+    initialize_grid(current_grid, &domain);
+    initialize_grid(next_grid, &domain);
+
+    // Resume from the latest checkpoint; only the interior is stored, the halos are rebuilt
+    global_diff = INFINITY;
+    if (opt.restart && load_checkpoint(current_grid, &domain, opt.checkpoint_prefix,
+                                       &iteration, &global_diff) != 0) {
+        if (rank == MASTER) {
+            printf("No valid checkpoint %s.0/.1 found, starting from the initial grid\n",
+                   opt.checkpoint_prefix);
+        }
+    }
+    int start_iteration = iteration;
+
+    Checkpoint checkpoint;
+    memset(&checkpoint, 0, sizeof(checkpoint));
+    if (opt.checkpoint_every > 0) {
+        checkpoint.snapshot = alloc_interior(&domain);
+    }
+
     if (rank == MASTER) {
         printf("Starting heat distribution simulation with %d processes\n", size);
-        printf("Grid size: %d x %d per process\n", rows-2, cols);
+        printf("Grid size: %d x %d on a %d x %d process grid\n", nx, ny, domain.dims[0], domain.dims[1]);
+        printf("Threads per process: %d, stencil kernel: %s, grid storage: %s\n", worker_threads(),
+               kernel_isa(), sizeof(real) == sizeof(float) ? "float" : "double");
+        if (worker_threads() > 1 && provided < MPI_THREAD_FUNNELED) {
+            printf("Warning: the MPI library does not support MPI_THREAD_FUNNELED\n");
+        }
+        if (opt.solver == SOLVER_JACOBI) {
+            printf("Solver: Jacobi\n");
+            printf("Halo exchange: %s, depth %d\n",
+                   opt.overlap ? "non-blocking, overlapped with the interior update" : "blocking",
+                   opt.halo_depth);
+        }
+    }
+
+    // Red-black SOR and multigrid update the grid in place; next_grid is only scratch for them
+    double omega = opt.omega > 0.0 ? opt.omega : optimal_omega(nx, ny);
+    Multigrid multigrid;
+    multigrid.count = 0;
+    if (opt.solver == SOLVER_SOR && rank == MASTER) {
+        printf("Solver: red-black SOR, omega = %.4f\n", omega);
+    }
+    if (opt.solver == SOLVER_MULTIGRID) {
+        setup_multigrid(&multigrid, &domain, current_grid);
+        if (multigrid.count < 2) {
+            // Without a coarser level a V-cycle is only SOR sweeps; every rank sees the same count
+            if (rank == MASTER) {
+                fprintf(stderr, "Multigrid needs a coarser level: grid %d x %d is too small for %d x %d processes\n",
+                        nx, ny, domain.dims[0], domain.dims[1]);
+            }
+            free_multigrid(&multigrid);
+            free(checkpoint.snapshot);
+            free_grid(current_grid);
+            free_grid(next_grid);
+            free_domain(&domain);
+            MPI_Finalize();
+            return 1;
+        }
+        if (rank == MASTER) {
+            const Domain *coarsest = &multigrid.level[multigrid.count - 1].d;
+            printf("Solver: multigrid V(%d,%d) cycles, %d levels, coarsest grid %d x %d\n",
+                   SMOOTHING_SWEEPS, SMOOTHING_SWEEPS, multigrid.count, coarsest->nx, coarsest->ny);
+        }
+    }
+
+    ConjugateGradient cg;
+    if (opt.solver == SOLVER_CG) {
+        const char *names[] = {"none", "block Jacobi"};
+        if (rank == MASTER) {
+            printf("Solver: conjugate gradient, %s preconditioner, tolerance %.1e\n",
+                   names[opt.preconditioner], opt.tolerance);
+        }
+    }
+
+    if (rank == MASTER) {
         start_time = MPI_Wtime();
     }
-    
-    // Main simulation loop
-    do {
-        // Exchange ghost rows with neighbors
-        exchange_ghost_rows(current_grid, rows, cols, rank, size);
-        
-        // Compute the next iteration
-        local_diff = compute_iteration(current_grid, next_grid, rows, cols);
-        
-        // Find global maximum difference
-        MPI_Allreduce(&local_diff, &global_diff, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
-        
-        // Swap the grids
-        double **temp = current_grid;
-        current_grid = next_grid;
-        next_grid = temp;
-        
-        iteration++;
-        
-        if (rank == MASTER && iteration % 100 == 0) {
-            printf("Iteration %d: maximum difference = %.6f\n", iteration, global_diff);
-        }
-        
-    } while (iteration < MAX_ITERATIONS && global_diff > CONVERGENCE_THRESHOLD);
-    
+    if (opt.solver == SOLVER_CG) {
+        setup_cg(&cg, current_grid, &domain, opt.preconditioner);
+    }
+
+    // Main simulation loop: one halo exchange per block of halo_depth sweeps. The change is
+    // only measured on the last sweep of a block that reaches a multiple of check_interval and
+    // is reduced with MPI_Iallreduce; the result is examined at the next check, so the run may
+    // stop up to one interval after convergence. With an interval of 1 the reduction is blocking
+    // and the run stops on the sweep that converged.
+    int exchanges = 0;
+    int converged = 0;
+    int pending = 0, pending_iteration = 0;
+    int printed_iteration = iteration;
+    double reduced_diff = 0.0;
+    double send_diff = 0.0;     // Send buffer of the pending reduction, untouched until the wait
+    MPI_Request reduce_request = MPI_REQUEST_NULL;
+    while (iteration < opt.max_iterations && !converged) {
+        int steps = opt.halo_depth;
+        if (steps > opt.max_iterations - iteration) {
+            steps = opt.max_iterations - iteration;
+        }
+        int check = (iteration + steps) / opt.check_interval != iteration / opt.check_interval ||
+                    iteration + steps == opt.max_iterations;
+
+        if (opt.solver == SOLVER_CG) {
+            // CG reduces every iteration anyway and stops on its relative residual
+            global_diff = cg_iteration(&cg, current_grid, &domain);
+            converged = global_diff <= opt.tolerance;
+            check = 0;
+            if (rank == MASTER && (iteration + 1) % 100 == 0) {
+                printf("Iteration %d: relative residual = %.6e\n", iteration + 1, global_diff);
+            }
+        } else if (opt.solver == SOLVER_SOR) {
+            local_diff = sor_iteration(current_grid, NULL, &domain, omega, check);
+        } else if (opt.solver == SOLVER_MULTIGRID) {
+            local_diff = multigrid_iteration(&multigrid, next_grid, check);
+        } else if (opt.overlap) {
+            // Exchange halos in the background while the interior is updated
+            local_diff = advance_overlapped(&current_grid, &next_grid, &domain, steps, check);
+        } else {
+            // Exchange ghost rows and columns with neighbors
+            exchange_ghost_rows(current_grid, &domain);
+
+            // Compute the next block of iterations
+            local_diff = advance_steps(&current_grid, &next_grid, &domain, steps, 1, check);
+        }
+        exchanges++;
+        iteration += steps;
+
+        if (pending && !check) {
+            // Give the background reduction a chance to progress
+            int done;
+            MPI_Test(&reduce_request, &done, MPI_STATUS_IGNORE);
+        }
+
+        if (check && opt.check_interval == 1) {
+            // Find global maximum difference of the last sweep
+            MPI_Allreduce(&local_diff, &global_diff, 1, MPI_DOUBLE, MPI_MAX, domain.comm);
+            converged = global_diff <= CONVERGENCE_THRESHOLD;
+            if (rank == MASTER && iteration / 100 != printed_iteration / 100) {
+                printf("Iteration %d: maximum difference = %.6f\n", iteration, global_diff);
+                printed_iteration = iteration;
+            }
+        } else if (check) {
+            // Collect the previous check; every rank decides at the same iteration
+            if (pending) {
+                MPI_Wait(&reduce_request, MPI_STATUS_IGNORE);
+                pending = 0;
+                global_diff = reduced_diff;
+                converged = global_diff <= CONVERGENCE_THRESHOLD;
+                if (rank == MASTER && pending_iteration / 100 != printed_iteration / 100) {
+                    printf("Iteration %d: maximum difference = %.6f\n", pending_iteration, global_diff);
+                    printed_iteration = pending_iteration;
+                }
+            }
+            if (!converged) {
+                // Find global maximum difference of the last sweep in the background
+                send_diff = local_diff;
+                MPI_Iallreduce(&send_diff, &reduced_diff, 1, MPI_DOUBLE, MPI_MAX, domain.comm,
+                               &reduce_request);
+                pending = 1;
+                pending_iteration = iteration;
+            }
+        }
+
+        // Snapshot the grid and let the checkpoint drain to disk during the next sweeps
+        if (opt.checkpoint_every > 0 && !converged && iteration < opt.max_iterations &&
+            iteration / opt.checkpoint_every != (iteration - steps) / opt.checkpoint_every) {
+            start_checkpoint(&checkpoint, current_grid, &domain, opt.checkpoint_prefix,
+                             iteration, global_diff);
+        }
+    }
+
+    // Report the last check that is still in flight
+    if (pending) {
+        MPI_Wait(&reduce_request, MPI_STATUS_IGNORE);
+        global_diff = reduced_diff;
+    }
+    finish_checkpoint(&checkpoint, &domain);
+
     // Measure end time
     if (rank == MASTER) {
         end_time = MPI_Wtime();
-        printf("Simulation completed after %d iterations\n", iteration);
+        if (opt.solver == SOLVER_JACOBI) {
+            printf("Simulation completed after %d iterations (%d halo exchanges)\n", iteration, exchanges);
+        } else {
+            printf("Simulation completed after %d iterations\n", iteration);
+        }
+        if (opt.solver == SOLVER_CG) {
+            printf("Final relative residual: %.6e\n", global_diff);
+        } else {
+            printf("Final maximum difference: %.6f\n", global_diff);
+        }
+        if (opt.checkpoint_every > 0) {
+            printf("Checkpoints written: %d\n", checkpoint.count);
+        }
         printf("Execution time: %.3f seconds\n", end_time - start_time);
+        if (opt.solver == SOLVER_JACOBI || opt.solver == SOLVER_SOR) {
+            // One lattice update per interior point and sweep
+            double updates = (double)(nx - 2) * (ny - 2) * (iteration - start_iteration);
+            double mlups = updates / (end_time - start_time) / 1e6;
+            printf("Stencil throughput: %.1f MLUP/s (%.1f per process, %.1f per thread)\n",
+                   mlups, mlups / size, mlups / (size * worker_threads()));
+        }
     }
-    
+
+    // The residual of the steady-state equations shows how far each solver really got
+    double residual = residual_norm(current_grid, &domain);
+    if (rank == MASTER) {
+        printf("Final maximum residual: %.6e\n", residual);
+    }
+    if (opt.reference != NULL) {
+        compare_reference(current_grid, &domain, opt.reference);
+    }
+
     // Save results to file
-    save_grid(current_grid, rows, cols, rank, size);
-    
+    if (opt.output == OUTPUT_BINARY) {
+        double io_start = MPI_Wtime();
+        save_grid_binary(current_grid, &domain, opt.output_file, iteration, global_diff);
+        if (rank == MASTER) {
+            printf("Output time: %.3f seconds\n", MPI_Wtime() - io_start);
+        }
+    } else if (opt.output == OUTPUT_CSV) {
+        save_grid(current_grid, &domain);
+    }
+
     // Clean up
-    for (int i = 0; i < rows; i++) {
-        free(current_grid[i]);
-        free(next_grid[i]);
+    free_grid(current_grid);
+    free_grid(next_grid);
+    free(checkpoint.snapshot);
+    if (multigrid.count > 0) {
+        free_multigrid(&multigrid);
     }
-    free(current_grid);
-    free(next_grid);
-    
+    if (opt.solver == SOLVER_CG) {
+        free_cg(&cg);
+    }
+    free_domain(&domain);
+
     MPI_Finalize();
     return 0;
 }
-
@@ -1,21 +1,166 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <mpi.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+#include <stdint.h>
 #include <time.h>
+#include "philox.h"
 
-// Custom reduction function for MPI_Op_create
-void sum_function(void* inputBuffer, void* outputBuffer, int* len, MPI_Datatype* datatype) {
-    int i;
-    int* input = (int*)inputBuffer;
-    int* output = (int*)outputBuffer;
-    
-    if (*datatype == MPI_INT) {
-        for (i = 0; i < *len; i++) {
-            output[i] += input[i];
-        }
+#define HIST_BINS 16            // Bins of the histogram datatype
+#define OPS_COUNT 4194304       // Default elements per buffer in the operator benchmark
+
+// Pair of a value and its index, laid out like MPI_2INT, MPI_LONG_INT (where long has 64
+// bits), MPI_FLOAT_INT and MPI_DOUBLE_INT, for MINLOC-style argmin/argmax
+typedef struct { int32_t value; int index; } int32_loc;
+typedef struct { int64_t value; int index; } int64_loc;
+typedef struct { float value; int index; } float_loc;
+typedef struct { double value; int index; } double_loc;
+
+// Partial sum with the rounding error carried alongside; the value is sum + error
+typedef struct {
+    double sum, error;
+} KahanSum;
+
+// Fixed-size histogram; buffers of them are reduced bin by bin
+typedef struct {
+    int count[HIST_BINS];
+} Histogram;
+
+MPI_Datatype MPI_KAHAN, MPI_HISTOGRAM;
+MPI_Op op_sum, op_min, op_max, op_argmin, op_argmax, op_kahan_sum, op_histogram;
+
+// One definition generates the element-wise kernels of every value type. The loops have no
+// dependences between elements and restrict-qualified arguments, so they are vectorized.
+#define DEFINE_KERNELS(T, NAME) \
+void sum_##NAME(const T *restrict in, T *restrict inout, int n) { \
+    _Pragma("omp simd") \
+    for (int i = 0; i < n; i++) inout[i] += in[i]; \
+} \
+void min_##NAME(const T *restrict in, T *restrict inout, int n) { \
+    _Pragma("omp simd") \
+    for (int i = 0; i < n; i++) inout[i] = in[i] < inout[i] ? in[i] : inout[i]; \
+} \
+void max_##NAME(const T *restrict in, T *restrict inout, int n) { \
+    _Pragma("omp simd") \
+    for (int i = 0; i < n; i++) inout[i] = in[i] > inout[i] ? in[i] : inout[i]; \
+} \
+void argmin_##NAME(const NAME##_loc *restrict in, NAME##_loc *restrict inout, int n) { \
+    _Pragma("omp simd") \
+    for (int i = 0; i < n; i++) { \
+        int take = in[i].value < inout[i].value || \
+                   (in[i].value == inout[i].value && in[i].index < inout[i].index); \
+        inout[i] = take ? in[i] : inout[i]; \
+    } \
+} \
+void argmax_##NAME(const NAME##_loc *restrict in, NAME##_loc *restrict inout, int n) { \
+    _Pragma("omp simd") \
+    for (int i = 0; i < n; i++) { \
+        int take = in[i].value > inout[i].value || \
+                   (in[i].value == inout[i].value && in[i].index < inout[i].index); \
+        inout[i] = take ? in[i] : inout[i]; \
+    } \
+}
+
+DEFINE_KERNELS(int32_t, int32)
+DEFINE_KERNELS(int64_t, int64)
+DEFINE_KERNELS(float, float)
+DEFINE_KERNELS(double, double)
+
+// Function to stop on a datatype an operator does not support, instead of ignoring it
+void unsupported_type(const char *op, MPI_Datatype type) {
+    char name[MPI_MAX_OBJECT_NAME];
+    int length;
+    MPI_Type_get_name(type, name, &length);
+    fprintf(stderr, "Reduction %s does not support datatype %s\n", op, length > 0 ? name : "(unnamed)");
+    MPI_Abort(MPI_COMM_WORLD, 1);
+}
+
+// Function-defining macros for the MPI_User_function of each operator, selecting the kernel
+// by the value type (or value-index pair type) of the buffer. long goes to the kernels of its
+// actual width: 64 bits on LP64, 32 bits on LLP64 and ILP32.
+#define DEFINE_VALUE_OP(OP) \
+void OP##_function(void *in, void *inout, int *len, MPI_Datatype *type) { \
+    if (*type == MPI_INT || *type == MPI_INT32_T || (*type == MPI_LONG && sizeof(long) == 4)) \
+        OP##_int32(in, inout, *len); \
+    else if (*type == MPI_INT64_T || *type == MPI_LONG_LONG || (*type == MPI_LONG && sizeof(long) == 8)) \
+        OP##_int64(in, inout, *len); \
+    else if (*type == MPI_FLOAT) OP##_float(in, inout, *len); \
+    else if (*type == MPI_DOUBLE) OP##_double(in, inout, *len); \
+    else unsupported_type(#OP, *type); \
+}
+#define DEFINE_PAIR_OP(OP) \
+void OP##_function(void *in, void *inout, int *len, MPI_Datatype *type) { \
+    if (*type == MPI_2INT || (*type == MPI_LONG_INT && sizeof(long) == 4)) OP##_int32(in, inout, *len); \
+    else if (*type == MPI_LONG_INT && sizeof(long) == 8) OP##_int64(in, inout, *len); \
+    else if (*type == MPI_FLOAT_INT) OP##_float(in, inout, *len); \
+    else if (*type == MPI_DOUBLE_INT) OP##_double(in, inout, *len); \
+    else unsupported_type(#OP, *type); \
+}
+
+// Custom reduction function for MPI_Op_create: element-wise sum of any integer or
+// floating-point type
+DEFINE_VALUE_OP(sum)
+DEFINE_VALUE_OP(min)
+DEFINE_VALUE_OP(max)
+DEFINE_PAIR_OP(argmin)
+DEFINE_PAIR_OP(argmax)
+
+// Function to add compensated partial sums: the exact error of each addition (Knuth's
+// TwoSum) is added to the carried errors, so the result keeps about twice the precision
+void kahan_sum_function(void *in, void *inout, int *len, MPI_Datatype *type) {
+    if (*type != MPI_KAHAN) unsupported_type("kahan_sum", *type);
+    const KahanSum *restrict a = (const KahanSum*)in;
+    KahanSum *restrict b = (KahanSum*)inout;
+    #pragma omp simd
+    for (int i = 0; i < *len; i++) {
+        double s = a[i].sum + b[i].sum;
+        double bb = s - a[i].sum;
+        double err = (a[i].sum - (s - bb)) + (b[i].sum - bb);
+        b[i].error += a[i].error + err;
+        b[i].sum = s;
     }
 }
 
+void histogram_function(void *in, void *inout, int *len, MPI_Datatype *type) {
+    if (*type != MPI_HISTOGRAM) unsupported_type("histogram", *type);
+    sum_int32(in, inout, *len * HIST_BINS);
+}
+
+// Function to create the datatypes and operators; all operators are commutative
+void create_ops(void) {
+    int lengths[2] = {1, 1};
+    MPI_Aint displs[2] = {offsetof(KahanSum, sum), offsetof(KahanSum, error)};
+    MPI_Datatype types[2] = {MPI_DOUBLE, MPI_DOUBLE};
+    MPI_Type_create_struct(2, lengths, displs, types, &MPI_KAHAN);
+    MPI_Type_set_name(MPI_KAHAN, "KahanSum");
+    MPI_Type_commit(&MPI_KAHAN);
+    MPI_Type_contiguous(HIST_BINS, MPI_INT, &MPI_HISTOGRAM);
+    MPI_Type_set_name(MPI_HISTOGRAM, "Histogram");
+    MPI_Type_commit(&MPI_HISTOGRAM);
+
+    MPI_Op_create(sum_function, 1, &op_sum);
+    MPI_Op_create(min_function, 1, &op_min);
+    MPI_Op_create(max_function, 1, &op_max);
+    MPI_Op_create(argmin_function, 1, &op_argmin);
+    MPI_Op_create(argmax_function, 1, &op_argmax);
+    MPI_Op_create(kahan_sum_function, 1, &op_kahan_sum);
+    MPI_Op_create(histogram_function, 1, &op_histogram);
+}
+
+void free_ops(void) {
+    MPI_Op_free(&op_sum);
+    MPI_Op_free(&op_min);
+    MPI_Op_free(&op_max);
+    MPI_Op_free(&op_argmin);
+    MPI_Op_free(&op_argmax);
+    MPI_Op_free(&op_kahan_sum);
+    MPI_Op_free(&op_histogram);
+    MPI_Type_free(&MPI_KAHAN);
+    MPI_Type_free(&MPI_HISTOGRAM);
+}
+
 // Manual reduction implementation (tree-based)
 int manual_reduction(int local_value, int rank, int size, MPI_Comm comm) {
     int global_sum = local_value;
@@ -43,6 +188,410 @@ int manual_reduction(int local_value, int rank, int size, MPI_Comm comm) {
     return global_sum;
 }
 
+// Allreduce algorithms for buffers of any length. They assume a commutative op and a
+// contiguous datatype; allreduce() falls back to MPI_Allreduce for non-commutative ops.
+#define ALLREDUCE_AUTO 0
+#define ALLREDUCE_RECURSIVE_DOUBLING 1
+#define ALLREDUCE_RABENSEIFNER 2
+#define ALLREDUCE_RING 3
+#define ALLREDUCE_MPI 4
+#define SMALL_MESSAGE 8192          // Bytes up to which recursive doubling is used
+#define MEDIUM_MESSAGE 1048576      // Bytes up to which Rabenseifner's algorithm is used
+#define SEGMENT_BYTES 65536         // Default segment size of the ring pipeline
+#define BENCH_MAX_BYTES 268435456   // Largest benchmark message (256 MB)
+
+const char *algorithm_names[] = {"auto", "recursive doubling", "Rabenseifner", "ring", "MPI_Allreduce"};
+
+// Function to get the address of element i of a buffer
+char *element(void *buf, long i, MPI_Aint extent) {
+    return (char*)buf + i * extent;
+}
+
+// Function to fold a communicator of any size onto a power of two: of the first 2r ranks,
+// where r = size - 2^k, each even rank hands its data to the odd rank above it and sits out.
+// Returns the rank among the 2^k remaining processes, or -1 for a process that sits out.
+int fold_in(void *buf, void *tmp, int count, MPI_Datatype type, MPI_Op op, int rank, int size,
+            int *pof2, MPI_Comm comm) {
+    int p = 1;
+    while (2 * p <= size) p *= 2;
+    int rest = size - p;
+    *pof2 = p;
+
+    if (rank < 2 * rest) {
+        if (rank % 2 == 0) {
+            MPI_Send(buf, count, type, rank + 1, 1, comm);
+            return -1;
+        }
+        MPI_Recv(tmp, count, type, rank - 1, 1, comm, MPI_STATUS_IGNORE);
+        MPI_Reduce_local(tmp, buf, count, type, op);
+        return rank / 2;
+    }
+    return rank - rest;
+}
+
+// Function to return the result to the processes that sat out after fold_in
+void fold_out(void *buf, int count, MPI_Datatype type, int rank, int size, int pof2, MPI_Comm comm) {
+    int rest = size - pof2;
+    if (rank < 2 * rest) {
+        if (rank % 2 == 0) MPI_Recv(buf, count, type, rank + 1, 2, comm, MPI_STATUS_IGNORE);
+        else MPI_Send(buf, count, type, rank - 1, 2, comm);
+    }
+}
+
+// Function to get the real rank of a process from its rank after fold_in
+int unfolded_rank(int newrank, int size, int pof2) {
+    int rest = size - pof2;
+    return newrank < rest ? 2 * newrank + 1 : newrank + rest;
+}
+
+// Recursive doubling: log2(P) exchanges of the whole buffer. Best for short messages,
+// where latency dominates.
+void allreduce_recursive_doubling(void *buf, int count, MPI_Datatype type, MPI_Op op, MPI_Comm comm) {
+    int rank, size, pof2;
+    MPI_Aint lb, extent;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    MPI_Type_get_extent(type, &lb, &extent);
+    void *tmp = malloc(count * extent + 1);
+
+    int newrank = fold_in(buf, tmp, count, type, op, rank, size, &pof2, comm);
+    if (newrank >= 0) {
+        for (int mask = 1; mask < pof2; mask *= 2) {
+            int partner = unfolded_rank(newrank ^ mask, size, pof2);
+            MPI_Sendrecv(buf, count, type, partner, 0, tmp, count, type, partner, 0, comm, MPI_STATUS_IGNORE);
+            MPI_Reduce_local(tmp, buf, count, type, op);
+        }
+    }
+    fold_out(buf, count, type, rank, size, pof2, comm);
+    free(tmp);
+}
+
+// Rabenseifner's algorithm: a reduce-scatter by recursive halving leaves each process with
+// 1/P of the reduced buffer, and an allgather by recursive doubling collects the rest. Each
+// process sends about twice the buffer in total, in log2(P) steps.
+void allreduce_rabenseifner(void *buf, int count, MPI_Datatype type, MPI_Op op, MPI_Comm comm) {
+    int rank, size, pof2;
+    MPI_Aint lb, extent;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    MPI_Type_get_extent(type, &lb, &extent);
+    void *tmp = malloc(count * extent + 1);
+
+    int newrank = fold_in(buf, tmp, count, type, op, rank, size, &pof2, comm);
+    if (newrank >= 0) {
+        // Block b of the buffer holds elements [count * b / pof2, count * (b + 1) / pof2)
+        int lo = 0, hi = pof2;
+        for (int mask = pof2 / 2; mask >= 1; mask /= 2) {
+            int partner = unfolded_rank(newrank ^ mask, size, pof2);
+            int mid = (lo + hi) / 2;
+            int keep_lo = newrank & mask ? mid : lo, keep_hi = newrank & mask ? hi : mid;
+            int send_lo = newrank & mask ? lo : mid, send_hi = newrank & mask ? mid : hi;
+            long keep0 = (long)count * keep_lo / pof2, keep1 = (long)count * keep_hi / pof2;
+            long send0 = (long)count * send_lo / pof2, send1 = (long)count * send_hi / pof2;
+
+            MPI_Sendrecv(element(buf, send0, extent), send1 - send0, type, partner, 0,
+                         tmp, keep1 - keep0, type, partner, 0, comm, MPI_STATUS_IGNORE);
+            MPI_Reduce_local(tmp, element(buf, keep0, extent), keep1 - keep0, type, op);
+            lo = keep_lo;
+            hi = keep_hi;
+        }
+
+        for (int mask = 1; mask < pof2; mask *= 2) {
+            int partner_new = newrank ^ mask;
+            int partner = unfolded_rank(partner_new, size, pof2);
+            // Both sides own the aligned group of mask blocks that contains their rank
+            int mine = newrank & ~(mask - 1), theirs = partner_new & ~(mask - 1);
+            long mine0 = (long)count * mine / pof2, mine1 = (long)count * (mine + mask) / pof2;
+            long theirs0 = (long)count * theirs / pof2, theirs1 = (long)count * (theirs + mask) / pof2;
+
+            MPI_Sendrecv(element(buf, mine0, extent), mine1 - mine0, type, partner, 0,
+                         element(buf, theirs0, extent), theirs1 - theirs0, type, partner, 0,
+                         comm, MPI_STATUS_IGNORE);
+        }
+    }
+    fold_out(buf, count, type, rank, size, pof2, comm);
+    free(tmp);
+}
+
+// Segmented ring: the buffer is cut into P chunks, reduced around the ring in P - 1 steps and
+// gathered around it in P - 1 more, so every process sends 2 (P - 1) / P of the buffer, which
+// is bandwidth-optimal. Chunks travel in segments of segment_bytes, and each segment is passed
+// on as soon as it has been reduced, so the steps overlap and the ring stays busy.
+void allreduce_ring(void *buf, int count, MPI_Datatype type, MPI_Op op, MPI_Comm comm, int segment_bytes) {
+    int rank, size;
+    MPI_Aint lb, extent;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    MPI_Type_get_extent(type, &lb, &extent);
+    if (size == 1) return;
+
+    int left = (rank - 1 + size) % size, right = (rank + 1) % size;
+    long max_chunk = (count + size - 1) / size;
+    long seg = segment_bytes / extent > 0 ? segment_bytes / extent : 1;
+    int num_segs = (int)((max_chunk + seg - 1) / seg);
+    if (num_segs < 1) num_segs = 1;
+    void *tmp = malloc(max_chunk * extent + 1);
+    MPI_Request *recv_req = (MPI_Request*)malloc(num_segs * sizeof(MPI_Request));
+    MPI_Request *send_req[2];
+    send_req[0] = (MPI_Request*)malloc(num_segs * sizeof(MPI_Request));
+    send_req[1] = (MPI_Request*)malloc(num_segs * sizeof(MPI_Request));
+    for (int j = 0; j < num_segs; j++) send_req[0][j] = send_req[1][j] = MPI_REQUEST_NULL;
+
+    // Step s of the reduce-scatter (s < size - 1) sends chunk rank - s and receives chunk
+    // rank - s - 1; step s of the allgather sends chunk rank + 1 - s and receives chunk rank - s.
+    // The chunk received in one step is the one sent in the next.
+    int steps = 2 * (size - 1);
+    for (int s = 0; s < steps; s++) {
+        int gather = s >= size - 1;
+        int g = gather ? s - (size - 1) : s;
+        int send_chunk = ((gather ? rank + 1 - g : rank - g) % size + size) % size;
+        int recv_chunk = ((gather ? rank - g : rank - g - 1) % size + size) % size;
+        long send0 = (long)count * send_chunk / size, send1 = (long)count * (send_chunk + 1) / size;
+        long recv0 = (long)count * recv_chunk / size, recv1 = (long)count * (recv_chunk + 1) / size;
+        MPI_Request *sends = send_req[s % 2];
+
+        // The first step of each phase sends its whole chunk up front; later steps' sends
+        // were started segment by segment during the previous step
+        if (s == 0 || s == size - 1) {
+            for (int j = 0; j < num_segs; j++) {
+                long a = send0 + j * seg, b = a + seg < send1 ? a + seg : send1;
+                if (a >= send1) break;
+                MPI_Isend(element(buf, a, extent), b - a, type, right, s, comm, &sends[j]);
+            }
+        }
+
+        for (int j = 0; j < num_segs; j++) {
+            long a = recv0 + j * seg, b = a + seg < recv1 ? a + seg : recv1;
+            recv_req[j] = MPI_REQUEST_NULL;
+            if (a >= recv1) continue;
+            void *dest = gather ? element(buf, a, extent) : element(tmp, a - recv0, extent);
+            MPI_Irecv(dest, b - a, type, left, s, comm, &recv_req[j]);
+        }
+        for (int j = 0; j < num_segs; j++) {
+            long a = recv0 + j * seg, b = a + seg < recv1 ? a + seg : recv1;
+            if (a >= recv1) break;
+            MPI_Wait(&recv_req[j], MPI_STATUS_IGNORE);
+            if (!gather) MPI_Reduce_local(element(tmp, a - recv0, extent), element(buf, a, extent), b - a, type, op);
+            // Forward the finished segment, except after the last step of each phase (the
+            // last reduce-scatter step leaves the fully reduced chunk, which the allgather's
+            // first step sends as a whole)
+            if (s + 1 < steps && s + 1 != size - 1) {
+                MPI_Isend(element(buf, a, extent), b - a, type, right, s + 1, comm, &send_req[(s + 1) % 2][j]);
+            }
+        }
+        // This step's sends must finish before their requests are reused two steps later;
+        // the next step's forwarded segments stay in flight
+        MPI_Waitall(num_segs, sends, MPI_STATUSES_IGNORE);
+    }
+
+    free(tmp);
+    free(recv_req);
+    free(send_req[0]);
+    free(send_req[1]);
+}
+
+// Function to choose the allreduce algorithm for a message: recursive doubling for short
+// messages, Rabenseifner's algorithm for medium ones and the pipelined ring for long ones
+int choose_algorithm(long bytes, int count, int size) {
+    if (bytes <= SMALL_MESSAGE || count < size) return ALLREDUCE_RECURSIVE_DOUBLING;
+    if (bytes <= MEDIUM_MESSAGE) return ALLREDUCE_RABENSEIFNER;
+    return ALLREDUCE_RING;
+}
+
+// Function to combine sendbuf (or recvbuf, with MPI_IN_PLACE) of all processes into recvbuf
+// of every process with the given algorithm
+void allreduce(const void *sendbuf, void *recvbuf, int count, MPI_Datatype type, MPI_Op op,
+               MPI_Comm comm, int algorithm, int segment_bytes) {
+    int size, commutative;
+    MPI_Aint lb, extent;
+    MPI_Comm_size(comm, &size);
+    MPI_Type_get_extent(type, &lb, &extent);
+    MPI_Op_commutative(op, &commutative);
+
+    if (algorithm == ALLREDUCE_MPI || !commutative) {
+        MPI_Allreduce(sendbuf, recvbuf, count, type, op, comm);
+        return;
+    }
+    if (sendbuf != MPI_IN_PLACE) memcpy(recvbuf, sendbuf, count * extent);
+    if (algorithm == ALLREDUCE_AUTO) algorithm = choose_algorithm(count * extent, count, size);
+
+    if (algorithm == ALLREDUCE_RECURSIVE_DOUBLING) allreduce_recursive_doubling(recvbuf, count, type, op, comm);
+    else if (algorithm == ALLREDUCE_RABENSEIFNER) allreduce_rabenseifner(recvbuf, count, type, op, comm);
+    else allreduce_ring(recvbuf, count, type, op, comm, segment_bytes);
+}
+
+// Function to time every allreduce algorithm on double vectors from 8 bytes to max_bytes,
+// checking each result against MPI_Allreduce
+void benchmark_allreduce(long max_bytes, int segment_bytes, int rank, int size, MPI_Comm comm) {
+    long max_count = max_bytes / sizeof(double);
+    double *send = (double*)malloc(max_count * sizeof(double));
+    double *result = (double*)malloc(max_count * sizeof(double));
+    double *expected = (double*)malloc(max_count * sizeof(double));
+    if (send == NULL || result == NULL || expected == NULL) {
+        fprintf(stderr, "Process %d: Memory allocation failed\n", rank);
+        MPI_Abort(comm, 1);
+    }
+    // Small integers, so every summation order gives the exact same result
+    for (long i = 0; i < max_count; i++) send[i] = (double)((i * 7 + rank * 13) % 101);
+
+    if (rank == 0) {
+        printf("\nAllreduce of double vectors (MPI_SUM) on %d processes, ring segments of %d bytes\n",
+               size, segment_bytes);
+        printf("%12s", "bytes");
+        for (int a = 0; a <= ALLREDUCE_MPI; a++) printf(" %20s", algorithm_names[a]);
+        printf("\n");
+    }
+
+    for (long bytes = 8; bytes <= max_bytes; bytes = bytes * 4 > max_bytes && bytes < max_bytes ? max_bytes : bytes * 4) {
+        int count = (int)(bytes / sizeof(double));
+        int iterations = (int)(16777216 / bytes);
+        if (iterations > 100) iterations = 100;
+        if (iterations < 3) iterations = 3;
+        int correct = 1;
+
+        MPI_Allreduce(send, expected, count, MPI_DOUBLE, MPI_SUM, comm);
+        if (rank == 0) printf("%12ld", bytes);
+        for (int a = 0; a <= ALLREDUCE_MPI; a++) {
+            allreduce(send, result, count, MPI_DOUBLE, MPI_SUM, comm, a, segment_bytes);
+            if (memcmp(result, expected, count * sizeof(double)) != 0) correct = 0;
+
+            MPI_Barrier(comm);
+            double start = MPI_Wtime();
+            for (int it = 0; it < iterations; it++) {
+                allreduce(send, result, count, MPI_DOUBLE, MPI_SUM, comm, a, segment_bytes);
+            }
+            double t = (MPI_Wtime() - start) / iterations, max_t;
+            MPI_Reduce(&t, &max_t, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+            if (rank == 0) printf(" %9.1f us %6.0f MB/s", max_t * 1e6, bytes / max_t / 1e6);
+        }
+        MPI_Allreduce(MPI_IN_PLACE, &correct, 1, MPI_INT, MPI_MIN, comm);
+        if (rank == 0) printf("%s (auto: %s)\n", correct ? "" : "  WRONG RESULT",
+                              algorithm_names[choose_algorithm(bytes, count, size)]);
+    }
+    free(send);
+    free(result);
+    free(expected);
+}
+
+// Function to fill a benchmark buffer of the given datatype with small integer values, so
+// every summation order gives the same result
+void fill_buffer(void *buf, int count, MPI_Datatype type, int rank) {
+    for (int i = 0; i < count; i++) {
+        int v = (int)(((long)i * 37 + rank * 11) % 1000) - 500;
+        if (type == MPI_INT) ((int32_t*)buf)[i] = v;
+        else if (type == MPI_INT64_T) ((int64_t*)buf)[i] = v;
+        else if (type == MPI_FLOAT) ((float*)buf)[i] = v;
+        else if (type == MPI_DOUBLE) ((double*)buf)[i] = v;
+        else if (type == MPI_FLOAT_INT) ((float_loc*)buf)[i] = (float_loc){v, rank};
+        else if (type == MPI_DOUBLE_INT) ((double_loc*)buf)[i] = (double_loc){v, rank};
+        else if (type == MPI_KAHAN) ((KahanSum*)buf)[i] = (KahanSum){v * 0.1, 0};
+        else if (type == MPI_HISTOGRAM) {
+            for (int b = 0; b < HIST_BINS; b++) ((Histogram*)buf)[i].count[b] = (v + b) & 7;
+        }
+    }
+}
+
+// Function to compare the results of the custom and the builtin operator
+int same_result(const void *custom, const void *builtin, int count, MPI_Datatype type) {
+    for (int i = 0; i < count; i++) {
+        if (type == MPI_FLOAT_INT) {
+            const float_loc *a = (const float_loc*)custom + i, *b = (const float_loc*)builtin + i;
+            if (a->value != b->value || a->index != b->index) return 0;
+        } else if (type == MPI_DOUBLE_INT) {
+            const double_loc *a = (const double_loc*)custom + i, *b = (const double_loc*)builtin + i;
+            if (a->value != b->value || a->index != b->index) return 0;
+        } else if (type == MPI_KAHAN) {
+            // The builtin reference is a plain MPI_SUM of the sums
+            double a = ((const KahanSum*)custom)[i].sum + ((const KahanSum*)custom)[i].error;
+            double b = ((const double*)builtin)[2 * i];
+            if (fabs(a - b) > 1e-9 * (fabs(b) + 1)) return 0;
+        }
+    }
+    if (type == MPI_FLOAT_INT || type == MPI_DOUBLE_INT || type == MPI_KAHAN) return 1;
+    MPI_Aint lb, extent;
+    MPI_Type_get_extent(type, &lb, &extent);
+    return memcmp(custom, builtin, count * extent) == 0;
+}
+
+// Function to time an operator: the rate of MPI_Reduce_local on one process, in GB/s of
+// buffer combined, and the time of an MPI_Allreduce over all processes
+void time_op(const void *in, void *inout, void *result, int count, MPI_Datatype type, MPI_Op op,
+             MPI_Comm comm, double *rate, double *allreduce_time) {
+    const int repeats = 5;
+    MPI_Aint lb, extent;
+    MPI_Type_get_extent(type, &lb, &extent);
+
+    memcpy(inout, in, count * extent);
+    double start = MPI_Wtime();
+    for (int r = 0; r < repeats; r++) MPI_Reduce_local(in, inout, count, type, op);
+    *rate = (double)repeats * count * extent / (MPI_Wtime() - start) / 1e9;
+
+    MPI_Barrier(comm);
+    start = MPI_Wtime();
+    for (int r = 0; r < repeats; r++) MPI_Allreduce(in, result, count, type, op, comm);
+    double t = (MPI_Wtime() - start) / repeats;
+    MPI_Allreduce(&t, allreduce_time, 1, MPI_DOUBLE, MPI_MAX, comm);
+}
+
+// Function to compare every custom operator with the matching builtin operator on buffers
+// of count elements
+void benchmark_ops(int count, int rank, int size, MPI_Comm comm) {
+    struct {
+        const char *name, *type_name;
+        MPI_Op op, builtin;
+        MPI_Datatype type, builtin_type;
+        int elements;                   // Elements of the datatype in the buffer
+        int builtin_elements;
+    } rows[] = {
+        {"sum", "int32", op_sum, MPI_SUM, MPI_INT, MPI_INT, count, count},
+        {"sum", "int64", op_sum, MPI_SUM, MPI_INT64_T, MPI_INT64_T, count, count},
+        {"sum", "float", op_sum, MPI_SUM, MPI_FLOAT, MPI_FLOAT, count, count},
+        {"sum", "double", op_sum, MPI_SUM, MPI_DOUBLE, MPI_DOUBLE, count, count},
+        {"min", "int32", op_min, MPI_MIN, MPI_INT, MPI_INT, count, count},
+        {"min", "double", op_min, MPI_MIN, MPI_DOUBLE, MPI_DOUBLE, count, count},
+        {"max", "int64", op_max, MPI_MAX, MPI_INT64_T, MPI_INT64_T, count, count},
+        {"max", "float", op_max, MPI_MAX, MPI_FLOAT, MPI_FLOAT, count, count},
+        {"argmin", "float+int", op_argmin, MPI_MINLOC, MPI_FLOAT_INT, MPI_FLOAT_INT, count, count},
+        {"argmax", "double+int", op_argmax, MPI_MAXLOC, MPI_DOUBLE_INT, MPI_DOUBLE_INT, count, count},
+        {"kahan", "KahanSum", op_kahan_sum, MPI_SUM, MPI_KAHAN, MPI_DOUBLE, count, 2 * count},
+        {"histogram", "Histogram", op_histogram, MPI_SUM, MPI_HISTOGRAM, MPI_INT,
+         count / HIST_BINS, count / HIST_BINS * HIST_BINS},
+    };
+    int num_rows = sizeof(rows) / sizeof(rows[0]);
+    size_t bytes = (size_t)count * sizeof(double_loc) + 1;
+    void *in = malloc(bytes), *inout = malloc(bytes), *result = malloc(bytes), *expected = malloc(bytes);
+    if (in == NULL || inout == NULL || result == NULL || expected == NULL) {
+        fprintf(stderr, "Process %d: Memory allocation failed\n", rank);
+        MPI_Abort(comm, 1);
+    }
+
+    if (rank == 0) {
+        printf("\nReduction operators on %d elements per process, %d processes\n", count, size);
+        printf("%-10s %-11s %13s %13s %14s %14s  %s\n", "operator", "datatype", "custom GB/s",
+               "builtin GB/s", "custom ms", "builtin ms", "result");
+    }
+    for (int r = 0; r < num_rows; r++) {
+        double custom_rate, builtin_rate, custom_time, builtin_time;
+        fill_buffer(in, rows[r].elements, rows[r].type, rank);
+        time_op(in, inout, result, rows[r].elements, rows[r].type, rows[r].op, comm,
+                &custom_rate, &custom_time);
+        // The builtin runs on the same bytes, viewed as its own datatype
+        time_op(in, inout, expected, rows[r].builtin_elements, rows[r].builtin_type, rows[r].builtin,
+                comm, &builtin_rate, &builtin_time);
+        int ok = same_result(result, expected, rows[r].elements, rows[r].type);
+        MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, comm);
+        if (rank == 0) {
+            printf("%-10s %-11s %13.2f %13.2f %14.3f %14.3f  %s\n", rows[r].name, rows[r].type_name,
+                   custom_rate, builtin_rate, custom_time * 1e3, builtin_time * 1e3,
+                   ok ? "matches builtin" : "DIFFERS");
+        }
+    }
+    free(in);
+    free(inout);
+    free(result);
+    free(expected);
+}
+
 int main(int argc, char** argv) {
     int rank, size, i;
     int array_size = 1000000;  // Default size
@@ -59,8 +608,24 @@ int main(int argc, char** argv) {
     MPI_Comm_size(MPI_COMM_WORLD, &size);
     
     // Process command line arguments
-    if (argc > 1) {
-        array_size = atoi(argv[1]);
+    long bench_bytes = 0;
+    int segment_bytes = SEGMENT_BYTES;
+    int ops_count = 0;
+    uint64_t seed = 0;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--allreduce") == 0) {
+            bench_bytes = BENCH_MAX_BYTES;
+            if (i + 1 < argc && argv[i + 1][0] != '-') bench_bytes = (long)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--ops") == 0) {
+            ops_count = OPS_COUNT;
+            if (i + 1 < argc && argv[i + 1][0] != '-') ops_count = (int)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--segment") == 0 && i + 1 < argc) {
+            segment_bytes = atoi(argv[++i]);
+        } else {
+            array_size = atoi(argv[i]);
+        }
     }
     
     // Calculate local array size (distribute evenly)
@@ -69,19 +634,21 @@ int main(int argc, char** argv) {
         local_size++;
     }
     
-    // Seed random number generator differently for each process
-    srand(time(NULL) + rank);
+    // Share one seed; every process generates its own slice of the global array, so the
+    // sums do not depend on the number of processes
+    if (seed == 0) seed = (uint64_t)time(NULL);
+    MPI_Bcast(&seed, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+    long first = (long)(array_size / size) * rank + (rank < array_size % size ? rank : array_size % size);
     
     // Allocate and initialize local array with random numbers (1-100)
     data = (int*)malloc(local_size * sizeof(int));
+    fill_int(data, local_size, first, 1, 100, seed, 0);
     for (i = 0; i < local_size; i++) {
-        data[i] = rand() % 100 + 1;
         local_sum += data[i];
     }
     
-    // Create a custom reduction operation
-    MPI_Op custom_sum_op;
-    MPI_Op_create(sum_function, 1, &custom_sum_op);
+    // Create the custom reduction operations
+    create_ops();
     
     if (rank == 0) {
         printf("Running reduction with %d processes on array of size %d\n", size, array_size);
@@ -105,7 +672,7 @@ int main(int argc, char** argv) {
     // METHOD 2: Using custom reduction operation
     MPI_Barrier(MPI_COMM_WORLD);
     start_time = MPI_Wtime();
-    MPI_Reduce(&local_sum, &global_sum_custom_op, 1, MPI_INT, custom_sum_op, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&local_sum, &global_sum_custom_op, 1, MPI_INT, op_sum, 0, MPI_COMM_WORLD);
     end_time = MPI_Wtime();
     
     if (rank == 0) {
@@ -147,8 +714,11 @@ int main(int argc, char** argv) {
         MPI_Barrier(MPI_COMM_WORLD);
     }
     
+    if (bench_bytes > 0) benchmark_allreduce(bench_bytes, segment_bytes, rank, size, MPI_COMM_WORLD);
+    if (ops_count > 0) benchmark_ops(ops_count, rank, size, MPI_COMM_WORLD);
+    
     // Clean up
-    MPI_Op_free(&custom_sum_op);
+    free_ops();
     free(data);
     MPI_Finalize();  
     return 0;
@@ -1,68 +1,381 @@
 #include <mpi.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "philox.h"
+#include "array_io.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-void print_array(int *arr, int size, int rank) {
-    printf("Process %d: ", rank);
-    for (int i = 0; i < size; i++) {
-        printf("%d ", arr[i]);
+#define N (1L << 24)            // Default number of elements (global)
+#define PRINT_LIMIT 32          // Arrays up to this size are printed
+#define SEGMENT_LENGTH 1000     // Default mean segment length of the segmented scans
+#define SCAN_LANES 8            // Independent accumulators of the vectorized reduction
+#define SCAN_GRAIN 65536        // Fewest elements per thread block of the local scan
+#define REPEATS 3               // Timed repetitions of each scan, the best one is reported
+
+// Element of a segmented scan as seen across blocks and processes: the combined value since
+// the last segment head, and whether a head occurred at all
+typedef struct {
+    int64_t value;
+    int64_t head;
+} SegmentPair;
+
+// An associative operator with its identity and the local kernels generated for it
+typedef struct {
+    const char *name;
+    int64_t identity;
+    int commute;
+    int64_t (*combine)(int64_t a, int64_t b);
+    int64_t (*reduce)(const int64_t *a, long n);
+    void (*scan)(int64_t *a, long n, int64_t carry, int exclusive);
+    void (*scan_segmented)(int64_t *a, const uint8_t *head, long n, int64_t carry, int exclusive);
+    MPI_User_function *function, *segmented_function;
+    MPI_Op op, segmented_op;
+} ScanOperator;
+
+MPI_Datatype MPI_SEGMENT_PAIR;
+
+// Function to stop on a datatype an operator does not support, instead of ignoring it
+void unsupported_type(const char *op, MPI_Datatype type) {
+    char name[MPI_MAX_OBJECT_NAME];
+    int length;
+    MPI_Type_get_name(type, name, &length);
+    fprintf(stderr, "Scan %s does not support datatype %s\n", op, length > 0 ? name : "(unnamed)");
+    MPI_Abort(MPI_COMM_WORLD, 1);
+}
+
+// One definition generates everything a scan needs for an associative operator COMBINE(a, b)
+// with identity IDENTITY: the reduction of pass 1, which runs over SCAN_LANES independent
+// accumulators (vectorized) if the operator is commutative and in order otherwise, the
+// inclusive/exclusive scans of pass 2, plain and segmented, and the MPI_User_functions of
+// the values and of the segment pairs. Adding an operator takes one more line below.
+#define DEFINE_SCAN_OPERATOR(NAME, IDENTITY, COMMUTE, COMBINE) \
+static int64_t NAME##_combine(int64_t a, int64_t b) { return COMBINE; } \
+int64_t NAME##_reduce(const int64_t *restrict x, long n) { \
+    int64_t total = IDENTITY; \
+    long i = 0; \
+    if (COMMUTE) { \
+        int64_t lane[SCAN_LANES]; \
+        for (int l = 0; l < SCAN_LANES; l++) lane[l] = IDENTITY; \
+        for (; i + SCAN_LANES <= n; i += SCAN_LANES) { \
+            _Pragma("omp simd") \
+            for (int l = 0; l < SCAN_LANES; l++) lane[l] = NAME##_combine(lane[l], x[i + l]); \
+        } \
+        for (int l = 0; l < SCAN_LANES; l++) total = NAME##_combine(total, lane[l]); \
+    } \
+    for (; i < n; i++) total = NAME##_combine(total, x[i]); \
+    return total; \
+} \
+void NAME##_scan(int64_t *restrict x, long n, int64_t carry, int exclusive) { \
+    if (exclusive) { \
+        for (long i = 0; i < n; i++) { \
+            int64_t value = x[i]; \
+            x[i] = carry; \
+            carry = NAME##_combine(carry, value); \
+        } \
+    } else { \
+        for (long i = 0; i < n; i++) x[i] = carry = NAME##_combine(carry, x[i]); \
+    } \
+} \
+void NAME##_scan_segmented(int64_t *restrict x, const uint8_t *restrict head, long n, int64_t carry, \
+                           int exclusive) { \
+    if (exclusive) { \
+        for (long i = 0; i < n; i++) { \
+            int64_t value = x[i]; \
+            x[i] = head[i] ? IDENTITY : carry; \
+            carry = head[i] ? value : NAME##_combine(carry, value); \
+        } \
+    } else { \
+        for (long i = 0; i < n; i++) x[i] = carry = head[i] ? x[i] : NAME##_combine(carry, x[i]); \
+    } \
+} \
+void NAME##_function(void *in, void *inout, int *len, MPI_Datatype *type) { \
+    if (*type != MPI_INT64_T) unsupported_type(#NAME, *type); \
+    const int64_t *a = (const int64_t*)in; \
+    int64_t *b = (int64_t*)inout; \
+    for (int i = 0; i < *len; i++) b[i] = NAME##_combine(a[i], b[i]); \
+} \
+void NAME##_segmented_function(void *in, void *inout, int *len, MPI_Datatype *type) { \
+    if (*type != MPI_SEGMENT_PAIR) unsupported_type(#NAME, *type); \
+    const SegmentPair *a = (const SegmentPair*)in; \
+    SegmentPair *b = (SegmentPair*)inout; \
+    for (int i = 0; i < *len; i++) { \
+        if (!b[i].head) b[i].value = NAME##_combine(a[i].value, b[i].value); \
+        b[i].head |= a[i].head; \
+    } \
+} \
+ScanOperator NAME##_operator = {#NAME, IDENTITY, COMMUTE, NAME##_combine, NAME##_reduce, NAME##_scan, \
+                                NAME##_scan_segmented, NAME##_function, NAME##_segmented_function, \
+                                MPI_OP_NULL, MPI_OP_NULL};
+
+DEFINE_SCAN_OPERATOR(sum, 0, 1, a + b)
+DEFINE_SCAN_OPERATOR(min, INT64_MAX, 1, b < a ? b : a)
+DEFINE_SCAN_OPERATOR(max, INT64_MIN, 1, b > a ? b : a)
+DEFINE_SCAN_OPERATOR(xor, 0, 1, a ^ b)
+// Not commutative: carries the last non-zero element forward over the zeros after it
+DEFINE_SCAN_OPERATOR(last, 0, 0, b != 0 ? b : a)
+
+ScanOperator *operators[] = {&sum_operator, &min_operator, &max_operator, &xor_operator, &last_operator};
+#define OPERATORS ((int)(sizeof(operators) / sizeof(operators[0])))
+
+// Function to create the segment pair datatype and the MPI operators of every scan operator
+void create_operators(void) {
+    MPI_Type_contiguous(2, MPI_INT64_T, &MPI_SEGMENT_PAIR);
+    MPI_Type_set_name(MPI_SEGMENT_PAIR, "SegmentPair");
+    MPI_Type_commit(&MPI_SEGMENT_PAIR);
+    for (int k = 0; k < OPERATORS; k++) {
+        MPI_Op_create(operators[k]->function, operators[k]->commute, &operators[k]->op);
+        // A segment head discards everything before it, so the pair combine never commutes
+        MPI_Op_create(operators[k]->segmented_function, 0, &operators[k]->segmented_op);
     }
-    printf("\n");
 }
 
-int main(int argc, char** argv) {
-    int world_rank, world_size;
-    
-    MPI_Init(&argc, &argv);
-    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
-    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+void free_operators(void) {
+    for (int k = 0; k < OPERATORS; k++) {
+        MPI_Op_free(&operators[k]->op);
+        MPI_Op_free(&operators[k]->segmented_op);
+    }
+    MPI_Type_free(&MPI_SEGMENT_PAIR);
+}
 
-    int N = 8;  // Total number of elements in the array
-    int local_size = N / world_size;  // Each process gets equal elements
+// Function to get the number of threads that share the work of one process
+int worker_threads(void) {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
 
-    int *arr = NULL;
-    int local_array[local_size];
-    int local_prefix[local_size];
+// Function to combine two segment pairs, x before y
+SegmentPair combine_pairs(const ScanOperator *op, SegmentPair x, SegmentPair y) {
+    SegmentPair r;
+    r.value = y.head ? y.value : op->combine(x.value, y.value);
+    r.head = x.head | y.head;
+    return r;
+}
 
-    if (world_rank == 0) {
-        // Master initializes the array
-        arr = (int*)malloc(N * sizeof(int));
-        for (int i = 0; i < N; i++) {
-            arr[i] = i + 1;  // Example array: {1, 2, 3, 4, 5, 6, 7, 8}
+// Function to reduce one block of a segmented scan: only the elements from the last head on
+// reach the elements after the block
+SegmentPair reduce_segmented(const ScanOperator *op, const int64_t *a, const uint8_t *head, long n) {
+    SegmentPair r;
+    long start = n;
+    while (start > 0 && !head[start - 1]) start--;
+    r.head = start > 0;
+    if (start > 0) start--;
+    r.value = op->reduce(a + start, n - start);
+    return r;
+}
+
+// Function to scan the n local elements of a distributed array in place (inclusive or
+// exclusive; segmented if head flags are given, a set flag starting a new segment). The
+// local part is cut into one block per thread. Pass 1 reduces every block, the block totals
+// are combined in order and MPI_Exscan combines the process totals into the value carried
+// into this process; pass 2 scans every block from its carry. The result stays distributed.
+void distributed_scan(int64_t *a, const uint8_t *head, long n, ScanOperator *op, int exclusive, MPI_Comm comm) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    long blocks = n / SCAN_GRAIN < worker_threads() ? n / SCAN_GRAIN : worker_threads();
+    if (blocks < 1) blocks = 1;
+    SegmentPair *carry = (SegmentPair*)malloc((blocks + 1) * sizeof(SegmentPair));
+
+    // Pass 1: the total of every block
+    #pragma omp parallel for schedule(static)
+    for (long b = 0; b < blocks; b++) {
+        long lo = n * b / blocks, hi = n * (b + 1) / blocks;
+        if (head != NULL) {
+            carry[b + 1] = reduce_segmented(op, a + lo, head + lo, hi - lo);
+        } else {
+            carry[b + 1].value = op->reduce(a + lo, hi - lo);
+            carry[b + 1].head = 0;
         }
-        printf("Initial Array:\n");
-        print_array(arr, N, world_rank);
     }
 
-    // Scatter the data to all processes
-    MPI_Scatter(arr, local_size, MPI_INT, local_array, local_size, MPI_INT, 0, MPI_COMM_WORLD);
+    // The process total, and the carry from all lower ranks (rank 0 starts from the identity)
+    SegmentPair total = {op->identity, 0}, offset = {op->identity, 0};
+    for (long b = 0; b < blocks; b++) total = combine_pairs(op, total, carry[b + 1]);
+    if (head != NULL) {
+        MPI_Exscan(&total, &offset, 1, MPI_SEGMENT_PAIR, op->segmented_op, comm);
+    } else {
+        MPI_Exscan(&total.value, &offset.value, 1, MPI_INT64_T, op->op, comm);
+    }
+    if (rank == 0) offset.value = op->identity;
+
+    // Exclusive scan of the block totals, starting from the carry into this process
+    carry[0] = offset;
+    for (long b = 0; b < blocks; b++) carry[b + 1] = combine_pairs(op, carry[b], carry[b + 1]);
 
-    // Compute local prefix sum
-    local_prefix[0] = local_array[0];
-    for (int i = 1; i < local_size; i++) {
-        local_prefix[i] = local_prefix[i - 1] + local_array[i];
+    // Pass 2: every block scanned from its carry
+    #pragma omp parallel for schedule(static)
+    for (long b = 0; b < blocks; b++) {
+        long lo = n * b / blocks, hi = n * (b + 1) / blocks;
+        if (head != NULL) op->scan_segmented(a + lo, head + lo, hi - lo, carry[b].value, exclusive);
+        else op->scan(a + lo, hi - lo, carry[b].value, exclusive);
     }
+    free(carry);
+}
 
-    // Get the previous sum from other processes
-    int prev_sum;
-    MPI_Scan(&local_prefix[local_size - 1], &prev_sum, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+// Function to check a distributed scan element by element. The inclusive value of the last
+// element of each process is passed along the ranks in order (empty processes forward it),
+// and every process rescans its input sequentially from the value it received. Returns the
+// number of wrong elements (on rank 0).
+long verify_scan(const int64_t *input, const uint8_t *head, const int64_t *out, long n,
+                 const ScanOperator *op, int exclusive, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    int64_t carry = op->identity, last;
 
-    // Adjust each process's local prefix sum (except the first process)
-    if (world_rank != 0) {
-        for (int i = 0; i < local_size; i++) {
-            local_prefix[i] += prev_sum - local_prefix[local_size - 1];
+    if (rank > 0) MPI_Recv(&carry, 1, MPI_INT64_T, rank - 1, 0, comm, MPI_STATUS_IGNORE);
+    if (n == 0) last = carry;
+    else if (!exclusive) last = out[n - 1];
+    else if (head != NULL && head[n - 1]) last = input[n - 1];
+    else last = op->combine(out[n - 1], input[n - 1]);
+    if (rank < size - 1) MPI_Send(&last, 1, MPI_INT64_T, rank + 1, 0, comm);
+
+    long errors = 0;
+    for (long i = 0; i < n; i++) {
+        int start = head != NULL && head[i];
+        int64_t inclusive = start ? input[i] : op->combine(carry, input[i]);
+        int64_t expected = !exclusive ? inclusive : (start ? op->identity : carry);
+        if (out[i] != expected) errors++;
+        carry = inclusive;
+    }
+    long total_errors = 0;
+    MPI_Reduce(&errors, &total_errors, 1, MPI_LONG, MPI_SUM, 0, comm);
+    return total_errors;
+}
+
+// Function to print a small distributed array on rank 0
+void print_array(const char *label, const int64_t *a, long n, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    int count = (int)n, *counts = NULL, *displs = NULL;
+    int64_t *all = NULL;
+
+    if (rank == 0) counts = (int*)malloc(size * sizeof(int));
+    MPI_Gather(&count, 1, MPI_INT, counts, 1, MPI_INT, 0, comm);
+    if (rank == 0) {
+        displs = (int*)malloc(size * sizeof(int));
+        int total = 0;
+        for (int r = 0; r < size; r++) {
+            displs[r] = total;
+            total += counts[r];
+        }
+        all = (int64_t*)malloc((total > 0 ? total : 1) * sizeof(int64_t));
+    }
+    MPI_Gatherv(a, count, MPI_INT64_T, all, counts, displs, MPI_INT64_T, 0, comm);
+    if (rank == 0) {
+        printf("%s:", label);
+        for (int i = 0; i < displs[size - 1] + counts[size - 1]; i++) printf(" %lld", (long long)all[i]);
+        printf("\n");
+        free(counts);
+        free(displs);
+        free(all);
+    }
+}
+
+int main(int argc, char** argv) {
+    int world_rank, world_size;
+    long long n = N;
+    long segment_length = SEGMENT_LENGTH;
+    uint64_t seed = 0;
+    const char *only = NULL;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+    int bad = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--op") == 0 && i + 1 < argc) only = argv[++i];
+        else if (strcmp(argv[i], "--segment-length") == 0 && i + 1 < argc) segment_length = atol(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) seed = strtoull(argv[++i], NULL, 10);
+        else if (argv[i][0] != '-') n = (long long)strtod(argv[i], NULL);
+        else bad = 1;
+    }
+    int selected = 0;
+    for (int k = 0; k < OPERATORS; k++)
+        if (only == NULL || strcmp(only, operators[k]->name) == 0) selected++;
+    if (bad || n < 1 || segment_length < 1 || selected == 0) {
+        if (world_rank == 0) {
+            printf("Usage: %s [N] [--op sum|min|max|xor|last] [--segment-length L] [--seed S]\n", argv[0]);
         }
+        MPI_Finalize();
+        return 1;
     }
+    create_operators();
 
-    // Gather results back to the root process
-    MPI_Gather(local_prefix, local_size, MPI_INT, arr, local_size, MPI_INT, 0, MPI_COMM_WORLD);
+    // Block distribution of the N elements, remainder to the first processes; every process
+    // generates its own elements and segment heads
+    long long first, count;
+    block_partition(n, world_size, world_rank, &first, &count);
+    long local_n = (long)count;
+    if (seed == 0) seed = (uint64_t)time(NULL);
+    MPI_Bcast(&seed, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
 
+    int64_t *input = (int64_t*)malloc((local_n > 0 ? local_n : 1) * sizeof(int64_t));
+    int64_t *work = (int64_t*)malloc((local_n > 0 ? local_n : 1) * sizeof(int64_t));
+    uint8_t *head = (uint8_t*)malloc(local_n > 0 ? local_n : 1);
+    if (input == NULL || work == NULL || head == NULL) {
+        fprintf(stderr, "Process %d: Memory allocation failed\n", world_rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    #pragma omp parallel for schedule(static)
+    for (long i = 0; i < local_n; i++) {
+        input[i] = bits_to_int(random_u64(seed, 0, first + i), -1000, 1000);
+        head[i] = random_u64(seed, 1, first + i) % segment_length == 0;
+    }
+
+    int cores = world_size * worker_threads();
     if (world_rank == 0) {
-        printf("Final Prefix Sum:\n");
-        print_array(arr, N, world_rank);
-        free(arr);
+        printf("Scanning %lld int64 elements on %d processes x %d threads (seed %llu, mean segment length %ld)\n",
+               n, world_size, worker_threads(), (unsigned long long)seed, segment_length);
+        printf("%-6s %-10s %-10s %12s %12s %16s %8s\n", "op", "kind", "segments", "time (s)",
+               "Gelem/s", "Melem/s per core", "check");
+    }
+    if (n <= PRINT_LIMIT) print_array("Initial Array", input, local_n, MPI_COMM_WORLD);
+
+    int failed = 0;
+    for (int k = 0; k < OPERATORS; k++) {
+        if (only != NULL && strcmp(only, operators[k]->name) != 0) continue;
+        for (int segmented = 0; segmented <= 1; segmented++) {
+            for (int exclusive = 0; exclusive <= 1; exclusive++) {
+                const uint8_t *flags = segmented ? head : NULL;
+                double best = 0.0;
+                for (int r = 0; r < REPEATS; r++) {
+                    memcpy(work, input, local_n * sizeof(int64_t));
+                    MPI_Barrier(MPI_COMM_WORLD);
+                    double start = MPI_Wtime();
+                    distributed_scan(work, flags, local_n, operators[k], exclusive, MPI_COMM_WORLD);
+                    double elapsed = MPI_Wtime() - start;
+                    MPI_Allreduce(MPI_IN_PLACE, &elapsed, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+                    if (r == 0 || elapsed < best) best = elapsed;
+                }
+                long errors = verify_scan(input, flags, work, local_n, operators[k], exclusive, MPI_COMM_WORLD);
+                if (world_rank == 0) {
+                    printf("%-6s %-10s %-10s %12.6f %12.3f %16.1f %8s\n", operators[k]->name,
+                           exclusive ? "exclusive" : "inclusive", segmented ? "segmented" : "-", best,
+                           n / best / 1e9, n / best / 1e6 / cores, errors == 0 ? "ok" : "FAILED");
+                    if (errors != 0) failed = 1;
+                }
+                if (n <= PRINT_LIMIT && operators[k] == &sum_operator && !segmented && !exclusive) {
+                    print_array("Final Prefix Sum", work, local_n, MPI_COMM_WORLD);
+                }
+            }
+        }
     }
+    if (world_rank == 0) printf("Verification: %s\n", failed ? "FAILED" : "all scans match a sequential rescan");
 
+    free(input);
+    free(work);
+    free(head);
+    free_operators();
     MPI_Finalize();
     return 0;
 }
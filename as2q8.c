@@ -1,57 +1,448 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
 #include <mpi.h>
+#include "array_io.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-#define ROW 4
+#define ROW 4                   // Default matrix size
 #define COL 4
+#define PRINT_LIMIT 8           // Matrices up to this size are printed
+#define TILE 32                 // Blocks up to TILE x TILE are transposed directly
+#define REPEATS 3               // Timed repetitions of each method, the best one is reported
+#define BASELINE_CHUNK (1L << 22)   // Doubles per copy of the memcpy baseline (32 MB of scratch)
 
-void printMatrix(int matrix[ROW][COL]) {
-    for (int i = 0; i < ROW; i++) {
-        for (int j = 0; j < COL; j++) {
-            printf("%d ", matrix[i][j]);
+enum { PACKED, DATATYPE, IN_PLACE, METHODS };
+const char *method_names[METHODS] = {"packed", "datatype", "inplace"};
+
+// Row-block distribution of an N x M matrix and of its M x N transpose
+typedef struct {
+    long n, m;              // Global size of the input matrix
+    int rank, size;
+    long row0, rows;        // Rows of the input owned by this process
+    long col0, cols;        // Rows of the transpose (columns of the input) owned by this process
+    int *row_first, *row_count;     // Input rows of every process
+    int *col_first, *col_count;     // Transpose rows of every process
+} Layout;
+
+// Function to set up the block distributions; the first processes take one extra row
+void setup_layout(Layout *l, long n, long m, MPI_Comm comm) {
+    long long first, count;
+    l->n = n;
+    l->m = m;
+    MPI_Comm_rank(comm, &l->rank);
+    MPI_Comm_size(comm, &l->size);
+    l->row_first = (int*)malloc(l->size * sizeof(int));
+    l->row_count = (int*)malloc(l->size * sizeof(int));
+    l->col_first = (int*)malloc(l->size * sizeof(int));
+    l->col_count = (int*)malloc(l->size * sizeof(int));
+    for (int p = 0; p < l->size; p++) {
+        block_partition(n, l->size, p, &first, &count);
+        l->row_first[p] = (int)first;
+        l->row_count[p] = (int)count;
+        block_partition(m, l->size, p, &first, &count);
+        l->col_first[p] = (int)first;
+        l->col_count[p] = (int)count;
+    }
+    l->row0 = l->row_first[l->rank];
+    l->rows = l->row_count[l->rank];
+    l->col0 = l->col_first[l->rank];
+    l->cols = l->col_count[l->rank];
+}
+
+void free_layout(Layout *l) {
+    free(l->row_first);
+    free(l->row_count);
+    free(l->col_first);
+    free(l->col_count);
+}
+
+// Function to allocate an array of doubles, stopping the run if there is not enough memory
+double *alloc_doubles(long count) {
+    double *ptr = (double*)malloc((count > 0 ? count : 1) * sizeof(double));
+    if (ptr == NULL) {
+        fprintf(stderr, "Memory allocation failed (%ld doubles)\n", count);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    return ptr;
+}
+
+// Function to transpose the rows x cols block at src (row stride ls) into dst (row stride ld).
+// The longer side is halved until the block fits a TILE x TILE tile, so every level of the
+// cache hierarchy sees blocks that fit it, without tuning for any of them (cache-oblivious).
+void transpose_block(const double *src, long ls, double *dst, long ld, long rows, long cols) {
+    if (rows <= TILE && cols <= TILE) {
+        for (long i = 0; i < rows; i++)
+            for (long j = 0; j < cols; j++)
+                dst[j * ld + i] = src[i * ls + j];
+    } else if (rows >= cols) {
+        long half = rows / 2;
+        transpose_block(src, ls, dst, ld, half, cols);
+        transpose_block(src + half * ls, ls, dst + half, ld, rows - half, cols);
+    } else {
+        long half = cols / 2;
+        transpose_block(src, ls, dst, ld, rows, half);
+        transpose_block(src + half, ls, dst + half * ld, ld, rows, cols - half);
+    }
+}
+
+// Function to transpose a rows x cols matrix with all threads, each taking a strip of columns
+void transpose_parallel(const double *src, long ls, double *dst, long ld, long rows, long cols) {
+    long strips = (cols + 8 * TILE - 1) / (8 * TILE);
+    #pragma omp parallel for schedule(dynamic)
+    for (long s = 0; s < strips; s++) {
+        long c0 = s * 8 * TILE, width = cols - c0 < 8 * TILE ? cols - c0 : 8 * TILE;
+        transpose_block(src + c0, ls, dst + c0 * ld, ld, rows, width);
+    }
+}
+
+// Function to transpose with packing: the local rows are transposed into the send buffer,
+// where the block for every process is then contiguous, the blocks are exchanged with one
+// MPI_Alltoall (MPI_Alltoallv if the blocks differ in size), and the received blocks are
+// copied row by row into place. times[] gets the pack, exchange and unpack times.
+void transpose_packed(const Layout *l, const double *a, double *b, double *send, double *recv,
+                      MPI_Comm comm, double times[3]) {
+    int size = l->size, uniform = 1;
+    int *scounts = (int*)malloc(size * sizeof(int)), *sdispls = (int*)malloc(size * sizeof(int));
+    int *rcounts = (int*)malloc(size * sizeof(int)), *rdispls = (int*)malloc(size * sizeof(int));
+    int roffset = 0;
+
+    for (int p = 0; p < size; p++) {
+        scounts[p] = (int)l->rows * l->col_count[p];
+        sdispls[p] = (int)l->rows * l->col_first[p];
+        rcounts[p] = l->row_count[p] * (int)l->cols;
+        rdispls[p] = roffset;
+        roffset += rcounts[p];
+        if (scounts[p] != scounts[0] || rcounts[p] != scounts[0]) uniform = 0;
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &uniform, 1, MPI_INT, MPI_MIN, comm);
+
+    double start = MPI_Wtime();
+    transpose_parallel(a, l->m, send, l->rows, l->rows, l->m);
+    times[0] = MPI_Wtime() - start;
+
+    start = MPI_Wtime();
+    if (uniform) {
+        MPI_Alltoall(send, scounts[0], MPI_DOUBLE, recv, scounts[0], MPI_DOUBLE, comm);
+    } else {
+        MPI_Alltoallv(send, scounts, sdispls, MPI_DOUBLE, recv, rcounts, rdispls, MPI_DOUBLE, comm);
+    }
+    times[1] = MPI_Wtime() - start;
+
+    // The block from process p holds our rows of the transpose for its columns r0_p ...
+    start = MPI_Wtime();
+    #pragma omp parallel for schedule(static)
+    for (long i = 0; i < l->cols; i++)
+        for (int p = 0; p < size; p++)
+            memcpy(b + i * l->n + l->row_first[p], recv + rdispls[p] + i * l->row_count[p],
+                   l->row_count[p] * sizeof(double));
+    times[2] = MPI_Wtime() - start;
+
+    free(scounts);
+    free(sdispls);
+    free(rcounts);
+    free(rdispls);
+}
+
+// Function to transpose without packing: MPI_Alltoallw sends every column block straight from
+// the input with a strided vector type, and the receive type writes each incoming row as a
+// column of the output (a stride-n vector resized to one element, repeated), so the MPI
+// library does the whole rearrangement.
+void transpose_datatype(const Layout *l, const double *a, double *b, MPI_Comm comm, double times[3]) {
+    int size = l->size;
+    int *scounts = (int*)malloc(size * sizeof(int)), *sdispls = (int*)malloc(size * sizeof(int));
+    int *rcounts = (int*)malloc(size * sizeof(int)), *rdispls = (int*)malloc(size * sizeof(int));
+    MPI_Datatype *stypes = (MPI_Datatype*)malloc(size * sizeof(MPI_Datatype));
+    MPI_Datatype *rtypes = (MPI_Datatype*)malloc(size * sizeof(MPI_Datatype));
+    MPI_Datatype column, column_one;
+
+    double start = MPI_Wtime();
+    MPI_Type_vector((int)l->cols, 1, (int)l->n, MPI_DOUBLE, &column);
+    MPI_Type_create_resized(column, 0, sizeof(double), &column_one);
+    for (int p = 0; p < size; p++) {
+        MPI_Type_vector((int)l->rows, l->col_count[p], (int)l->m, MPI_DOUBLE, &stypes[p]);
+        MPI_Type_commit(&stypes[p]);
+        MPI_Type_contiguous(l->row_count[p], column_one, &rtypes[p]);
+        MPI_Type_commit(&rtypes[p]);
+        scounts[p] = l->rows > 0 && l->col_count[p] > 0 ? 1 : 0;
+        rcounts[p] = l->cols > 0 && l->row_count[p] > 0 ? 1 : 0;
+        sdispls[p] = l->col_first[p] * (int)sizeof(double);
+        rdispls[p] = l->row_first[p] * (int)sizeof(double);
+    }
+    times[0] = MPI_Wtime() - start;
+
+    start = MPI_Wtime();
+    MPI_Alltoallw(a, scounts, sdispls, stypes, b, rcounts, rdispls, rtypes, comm);
+    times[1] = MPI_Wtime() - start;
+    times[2] = 0.0;
+
+    for (int p = 0; p < size; p++) {
+        MPI_Type_free(&stypes[p]);
+        MPI_Type_free(&rtypes[p]);
+    }
+    MPI_Type_free(&column_one);
+    MPI_Type_free(&column);
+    free(stypes);
+    free(rtypes);
+    free(scounts);
+    free(sdispls);
+    free(rcounts);
+    free(rdispls);
+}
+
+// Element permutations of the in-place transpose of a square matrix, for nr local rows:
+// the local transpose [i][c] -> [c][i], and after the exchange the blocks [p][j][i] from
+// every process p -> [j][r0_p + i]
+long local_transpose_target(const Layout *l, long pos) {
+    long i = pos / l->n, c = pos % l->n;
+    return c * l->rows + i;
+}
+
+long unpack_target(const Layout *l, long pos) {
+    // The global column pos / rows lies in the rows of the process p the element came from
+    long k = pos / l->rows, base = l->n / l->size, extra = l->n % l->size;
+    int p = (int)(k < extra * (base + 1) ? k / (base + 1) : extra + (k - extra * (base + 1)) / base);
+    long offset = pos - (long)l->row_first[p] * l->rows;
+    long j = offset / l->row_count[p], i = offset % l->row_count[p];
+    return j * l->n + l->row_first[p] + i;
+}
+
+// Function to apply a permutation to a[0, count) in place by following its cycles; a bitmap
+// (one bit per element) marks the elements already moved
+void permute_in_place(double *a, long count, const Layout *l, long (*target)(const Layout*, long),
+                      uint64_t *moved) {
+    memset(moved, 0, ((count + 63) / 64) * sizeof(uint64_t));
+    for (long s = 0; s < count; s++) {
+        if (moved[s / 64] >> (s % 64) & 1) continue;
+        double carry = a[s];
+        long pos = s;
+        do {
+            long t = target(l, pos);
+            double displaced = a[t];
+            a[t] = carry;
+            carry = displaced;
+            moved[t / 64] |= 1ULL << (t % 64);
+            pos = t;
+        } while (pos != s);
+    }
+}
+
+// Function to transpose a square matrix in place: the local rows are transposed in place so
+// that the block for every process is contiguous, the blocks are swapped with an in-place
+// MPI_Alltoallv (square matrices send and receive the same amounts with every process), and
+// the received blocks are permuted into rows. Needs only a bitmap of one bit per local
+// element, (rows * n + 63) / 64 words, beyond the matrix, at the price of serial, irregular
+// permutations.
+void transpose_in_place(const Layout *l, double *a, uint64_t *moved, MPI_Comm comm, double times[3]) {
+    int size = l->size;
+    int *counts = (int*)malloc(size * sizeof(int)), *displs = (int*)malloc(size * sizeof(int));
+    long local = l->rows * l->n;
+
+    for (int p = 0; p < size; p++) {
+        counts[p] = (int)l->rows * l->row_count[p];
+        displs[p] = (int)l->rows * l->row_first[p];
+    }
+
+    double start = MPI_Wtime();
+    if (l->rows > 0) permute_in_place(a, local, l, local_transpose_target, moved);
+    times[0] = MPI_Wtime() - start;
+
+    start = MPI_Wtime();
+    MPI_Alltoallv(MPI_IN_PLACE, NULL, NULL, MPI_DOUBLE, a, counts, displs, MPI_DOUBLE, comm);
+    times[1] = MPI_Wtime() - start;
+
+    start = MPI_Wtime();
+    if (l->rows > 0) permute_in_place(a, local, l, unpack_target, moved);
+    times[2] = MPI_Wtime() - start;
+
+    free(counts);
+    free(displs);
+}
+
+// Function to fill the local rows of the input: entry (i, j) is i * m + j
+void fill_matrix(const Layout *l, double *a) {
+    #pragma omp parallel for schedule(static)
+    for (long i = 0; i < l->rows; i++)
+        for (long j = 0; j < l->m; j++)
+            a[i * l->m + j] = (double)(l->row0 + i) * l->m + j;
+}
+
+// Function to count the wrong entries of the local rows of the transpose (on rank 0)
+long check_transpose(const Layout *l, const double *b, MPI_Comm comm) {
+    long errors = 0, total = 0;
+    #pragma omp parallel for schedule(static) reduction(+:errors)
+    for (long k = 0; k < l->cols; k++)
+        for (long j = 0; j < l->n; j++)
+            if (b[k * l->n + j] != (double)j * l->m + l->col0 + k) errors++;
+    MPI_Reduce(&errors, &total, 1, MPI_LONG, MPI_SUM, 0, comm);
+    return total;
+}
+
+// Function to print a small row-distributed matrix with rows x cols entries on rank 0
+void print_matrix(const char *label, const double *local, const int *row_count, long rows, long cols,
+                  MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    int *counts = (int*)malloc(size * sizeof(int)), *displs = (int*)malloc(size * sizeof(int));
+    double *all = alloc_doubles(rows * cols);
+    int offset = 0;
+
+    for (int p = 0; p < size; p++) {
+        counts[p] = row_count[p] * (int)cols;
+        displs[p] = offset;
+        offset += counts[p];
+    }
+    MPI_Gatherv(local, counts[rank], MPI_DOUBLE, all, counts, displs, MPI_DOUBLE, 0, comm);
+    if (rank == 0) {
+        printf("\n%s:\n", label);
+        for (long i = 0; i < rows; i++) {
+            for (long j = 0; j < cols; j++) {
+                printf("%g ", all[i * cols + j]);
+            }
+            printf("\n");
         }
-        printf("\n");
     }
+    free(counts);
+    free(displs);
+    free(all);
 }
 
 int main(int argc, char *argv[]) {
     int rank, size;
-    int matrix[ROW][COL] = {
-        {1, 2, 3, 4},
-        {5, 6, 7, 8},
-        {9, 10, 11, 12},
-        {13, 14, 15, 16}
-    };
-    int transposed[COL][ROW];
-    int local_row[COL];
-
-    MPI_Init(&argc, &argv);  
+    long n = ROW, m = -1;
+    int only = -1, bad = 0, positional = 0;
+
+    MPI_Init(&argc, &argv);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
-    if (size != ROW) {
-        if (rank == 0)
-            printf("This program requires %d MPI processes!\n", ROW);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--method") == 0 && i + 1 < argc) {
+            i++;
+            for (int k = 0; k < METHODS; k++)
+                if (strcmp(argv[i], method_names[k]) == 0) only = k;
+            if (only < 0) bad = 1;
+        } else if (argv[i][0] != '-') {
+            if (positional++ == 0) n = atol(argv[i]);
+            else m = atol(argv[i]);
+        } else {
+            bad = 1;
+        }
+    }
+    if (m < 0) m = positional == 0 ? COL : n;
+    // Local blocks and MPI counts are indexed with int
+    if (bad || n < 1 || m < 1 || n > INT_MAX || m > INT_MAX ||
+        (n / size + 1) * m > INT_MAX || (m / size + 1) * n > INT_MAX) {
+        if (rank == 0) printf("Usage: %s [N [M]] [--method packed|datatype|inplace]\n", argv[0]);
         MPI_Finalize();
-        return 0;
+        return 1;
     }
 
-    // Scatter rows of the matrix to each process
-    MPI_Scatter(matrix, COL, MPI_INT, local_row, COL, MPI_INT, 0, MPI_COMM_WORLD);
+    Layout l;
+    setup_layout(&l, n, m, MPI_COMM_WORLD);
+    long local_in = l.rows * m, local_out = l.cols * n;
+    double bytes = (double)n * m * sizeof(double);
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+
+    double *a = alloc_doubles(local_in), *b = NULL;
+    fill_matrix(&l, a);
+    if (n <= PRINT_LIMIT && m <= PRINT_LIMIT) print_matrix("Original Matrix", a, l.row_count, n, m, MPI_COMM_WORLD);
 
-    // Each process sends its row to the correct column of the transposed matrix
-    for (int i = 0; i < COL; i++) {
-        MPI_Gather(&local_row[i], 1, MPI_INT, &transposed[i], 1, MPI_INT, 0, MPI_COMM_WORLD);
+    // Baseline: a plain copy of the local rows, the best a transpose could do per process. It
+    // goes through a scratch buffer of at most BASELINE_CHUNK doubles, which is still far larger
+    // than the caches but keeps the memory peak of the in-place method down; reading back the
+    // end of every chunk keeps the copies from being optimized away.
+    long chunk = local_in < BASELINE_CHUNK ? local_in : BASELINE_CHUNK;
+    double *scratch = alloc_doubles(chunk);
+    volatile double sink;
+    double memcpy_time = 0.0;
+    for (int r = 0; r < REPEATS; r++) {
+        double start = MPI_Wtime();
+        for (long i = 0; i < local_in; i += chunk) {
+            long count = local_in - i < chunk ? local_in - i : chunk;
+            memcpy(scratch, a + i, count * sizeof(double));
+            sink = scratch[count - 1];
+        }
+        double elapsed = MPI_Wtime() - start;
+        if (r == 0 || elapsed < memcpy_time) memcpy_time = elapsed;
     }
+    (void)sink;
+    free(scratch);
+    MPI_Allreduce(MPI_IN_PLACE, &memcpy_time, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    double memcpy_rate = (double)(n / size + (n % size ? 1 : 0)) * m * sizeof(double) / memcpy_time / 1e9;
 
-    // Process 0 prints the transposed matrix
     if (rank == 0) {
-        printf("\nOriginal Matrix:\n");
-        printMatrix(matrix);
+        printf("\nTransposing a %ld x %ld matrix of doubles (%.1f MB) on %d processes x %d threads\n",
+               n, m, bytes / 1e6, size, threads);
+        printf("memcpy of the local rows: %.3f GB/s per process\n", memcpy_rate);
+        printf("%-9s %10s %10s %10s %10s %10s %14s %8s %7s\n", "method", "local (s)", "exchange",
+               "unpack", "total (s)", "GB/s", "GB/s per proc", "memcpy", "check");
+    }
+
+    // Every method allocates only the buffers it needs
+    double *send = NULL, *recv = NULL;
+    uint64_t *moved = NULL;
+    int failed = 0;
+    for (int k = 0; k < METHODS; k++) {
+        if (only >= 0 && k != only) continue;
+        if (k == IN_PLACE && n != m) {
+            if (rank == 0) printf("%-9s needs a square matrix\n", method_names[k]);
+            continue;
+        }
+        if (k != IN_PLACE) b = alloc_doubles(local_out);
+        if (k == PACKED) {
+            send = alloc_doubles(local_in);
+            recv = alloc_doubles(local_out);
+        } else if (k == IN_PLACE) {
+            moved = (uint64_t*)malloc(((local_in + 63) / 64 + 1) * sizeof(uint64_t));
+        }
+
+        double best[4] = {0.0, 0.0, 0.0, 0.0};
+        for (int r = 0; r < REPEATS; r++) {
+            double times[4];
+            if (k == IN_PLACE) fill_matrix(&l, a);
+            MPI_Barrier(MPI_COMM_WORLD);
+            double start = MPI_Wtime();
+            if (k == PACKED) transpose_packed(&l, a, b, send, recv, MPI_COMM_WORLD, times);
+            else if (k == DATATYPE) transpose_datatype(&l, a, b, MPI_COMM_WORLD, times);
+            else transpose_in_place(&l, a, moved, MPI_COMM_WORLD, times);
+            times[3] = MPI_Wtime() - start;
+            MPI_Allreduce(MPI_IN_PLACE, times, 4, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+            if (r == 0 || times[3] < best[3]) memcpy(best, times, sizeof(best));
+        }
+
+        const double *result = k == IN_PLACE ? a : b;
+        long errors = check_transpose(&l, result, MPI_COMM_WORLD);
+        if (rank == 0) {
+            double rate = bytes / best[3] / 1e9;
+            printf("%-9s %10.6f %10.6f %10.6f %10.6f %10.3f %14.3f %7.0f%% %7s\n", method_names[k],
+                   best[0], best[1], best[2], best[3], rate, rate / size, 100.0 * rate / size / memcpy_rate,
+                   errors == 0 ? "ok" : "FAILED");
+            if (errors != 0) failed = 1;
+        }
+        if (n <= PRINT_LIMIT && m <= PRINT_LIMIT && (only >= 0 || k == PACKED)) {
+            print_matrix("Transposed Matrix", result, l.col_count, m, n, MPI_COMM_WORLD);
+        }
 
-        printf("\nTransposed Matrix:\n");
-        printMatrix(transposed);
+        free(b);
+        free(send);
+        free(recv);
+        free(moved);
+        b = send = recv = NULL;
+        moved = NULL;
     }
+    if (rank == 0) printf("Verification: %s\n", failed ? "FAILED" : "every transpose is correct");
 
+    free(a);
+    free_layout(&l);
     MPI_Finalize();
     return 0;
 }
@@ -1,6 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <mpi.h>
+#include <stdint.h>
+#include <time.h>
+#include <string.h>
+#include "philox.h"
+#include "array_io.h"
 #define N (1 << 16) // 2^16 elements
 // Serial version of DAXPY
 void daxpy_serial(double *X, double *Y, double a, int n) {
@@ -8,22 +13,12 @@ void daxpy_serial(double *X, double *Y, double a, int n) {
         X[i] = a * X[i] + Y[i];
     }
 }
-// Parallel version of DAXPY using MPI
-void daxpy_parallel(double *X, double *Y, double a, int n, int rank, int size) {
-    int local_n = n / size; // Local size for each process
-    double *local_X = (double *)malloc(local_n * sizeof(double));
-    double *local_Y = (double *)malloc(local_n * sizeof(double));
-    // Scatter data to all processes
-    MPI_Scatter(X, local_n, MPI_DOUBLE, local_X, local_n, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-    MPI_Scatter(Y, local_n, MPI_DOUBLE, local_Y, local_n, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-    // Perform DAXPY operation locally
+// Parallel version of DAXPY using MPI: every process updates the slice it generated itself,
+// so no data is scattered or gathered
+void daxpy_parallel(double *local_X, double *local_Y, double a, int local_n) {
     for (int i = 0; i < local_n; i++) {
         local_X[i] = a * local_X[i] + local_Y[i];
     }
-    // Gather the results back to the root process
-    MPI_Gather(local_X, local_n, MPI_DOUBLE, X, local_n, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-    free(local_X);
-    free(local_Y);
 }
 
 int main(int argc, char *argv[]) {
@@ -35,39 +30,122 @@ int main(int argc, char *argv[]) {
     MPI_Init(&argc, &argv);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
-    // Allocate memory for the vectors X and Y (only on root process)
+    // X and Y are generated, or read from two vector files given with --input
+    const char *input[2] = {NULL, NULL};
+    int method = LOAD_MPIIO, n = N;
+    ArrayHeader header[2];
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--input") == 0 && i + 2 < argc) {
+            input[0] = argv[++i];
+            input[1] = argv[++i];
+        } else if (strcmp(argv[i], "--mmap") == 0) {
+            method = LOAD_MMAP;
+        }
+    }
+    if (input[0] != NULL) {
+        if (read_array_header(input[0], &header[0], MPI_COMM_WORLD) != 0 ||
+            read_array_header(input[1], &header[1], MPI_COMM_WORLD) != 0) {
+            MPI_Finalize();
+            return 1;
+        }
+        if (header[0].type != ARRAY_DOUBLE || header[1].type != ARRAY_DOUBLE || header[0].cols != 1 ||
+            header[1].cols != 1 || header[0].rows != header[1].rows || header[0].rows > 2147483647) {
+            if (rank == 0) printf("The inputs must be two double vectors of the same length\n");
+            MPI_Finalize();
+            return 1;
+        }
+        n = (int)header[0].rows;
+    }
+    // One seed for all processes; X and Y are streams 0 and 1 of the counter-based generator
+    uint64_t seed = (uint64_t)time(NULL);
+    MPI_Bcast(&seed, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+    // Block distribution of the n elements, remainder to the first processes
+    long long first, count;
+    block_partition(n, size, rank, &first, &count);
+    int local_n = (int)count;
+    // The serial baseline needs the whole vectors on the root process
     if (rank == 0) {
-        X = (double *)malloc(N * sizeof(double));
-        Y = (double *)malloc(N * sizeof(double));
-        // Initialize X and Y vectors
-        for (int i = 0; i < N; i++) {
-            X[i] = i * 1.0; // Some example initialization
-            Y[i] = i * 2.0; // Some example initialization
+        if (input[0] != NULL) {
+            X = (double *)load_block(input[0], &header[0], 0, n, 0, 1, method, MPI_COMM_SELF);
+            Y = (double *)load_block(input[1], &header[1], 0, n, 0, 1, method, MPI_COMM_SELF);
+        } else {
+            X = (double *)malloc(n * sizeof(double));
+            Y = (double *)malloc(n * sizeof(double));
+            fill_uniform(X, n, 0, -1.0, 1.0, seed, 0);
+            fill_uniform(Y, n, 0, -1.0, 1.0, seed, 1);
         }
     }
     // Serial version timing
     if (rank == 0) {
         serial_start = MPI_Wtime();
-        daxpy_serial(X, Y, a, N);
+        daxpy_serial(X, Y, a, n);
         serial_end = MPI_Wtime();
         serial_time = serial_end - serial_start;
         printf("Serial Time: %f seconds\n", serial_time);
     }
+    // Every process generates or reads exactly its own slice of X and Y
+    double *local_X, *local_Y;
+    if (input[0] != NULL) {
+        MPI_Barrier(MPI_COMM_WORLD);
+        double load_start = MPI_Wtime();
+        local_X = (double *)load_block(input[0], &header[0], first, count, 0, 1, method, MPI_COMM_WORLD);
+        local_Y = (double *)load_block(input[1], &header[1], first, count, 0, 1, method, MPI_COMM_WORLD);
+        double load_time = MPI_Wtime() - load_start, max_load;
+        MPI_Reduce(&load_time, &max_load, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+        if (rank == 0) {
+            printf("Loaded %d elements of X and Y with %s in %f seconds (%.2f GB/s)\n", n,
+                   method == LOAD_MMAP ? "mmap" : "MPI-IO", max_load, 2.0 * n * sizeof(double) / max_load / 1e9);
+        }
+    } else {
+        local_X = (double *)malloc(local_n * sizeof(double));
+        local_Y = (double *)malloc(local_n * sizeof(double));
+        fill_uniform(local_X, local_n, first, -1.0, 1.0, seed, 0);
+        fill_uniform(local_Y, local_n, first, -1.0, 1.0, seed, 1);
+    }
     // Parallel version timing
+    MPI_Barrier(MPI_COMM_WORLD);
     parallel_start = MPI_Wtime();
-    daxpy_parallel(X, Y, a, N, rank, size);
+    daxpy_parallel(local_X, local_Y, a, local_n);
     parallel_end = MPI_Wtime();
     parallel_time = parallel_end - parallel_start;
+    // The slowest process bounds the parallel time
+    double max_time;
+    MPI_Reduce(&parallel_time, &max_time, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    // Check the slices against the serial result (outside the timing)
+    int *counts = NULL, *displs = NULL;
+    double *result = NULL;
+    if (rank == 0) {
+        counts = (int *)malloc(size * sizeof(int));
+        displs = (int *)malloc(size * sizeof(int));
+        result = (double *)malloc(n * sizeof(double));
+        for (int r = 0; r < size; r++) {
+            long long r_first, r_count;
+            block_partition(n, size, r, &r_first, &r_count);
+            counts[r] = (int)r_count;
+            displs[r] = (int)r_first;
+        }
+    }
+    MPI_Gatherv(local_X, local_n, MPI_DOUBLE, result, counts, displs, MPI_DOUBLE, 0, MPI_COMM_WORLD);
 
     if (rank == 0) {
-        printf("Parallel Time (using %d processes): %f seconds\n", size, parallel_time);
-        printf("Speedup: %f\n", serial_time / parallel_time);
+        int mismatches = 0;
+        for (int i = 0; i < n; i++) {
+            if (result[i] != X[i]) mismatches++;
+        }
+        printf("Parallel Time (using %d processes): %f seconds\n", size, max_time);
+        printf("Speedup: %f\n", serial_time / max_time);
+        printf("Verification: %s\n", mismatches == 0 ? "parallel result matches the serial one" : "MISMATCH");
     }
     // Clean up
     if (rank == 0) {
         free(X);
         free(Y);
+        free(counts);
+        free(displs);
+        free(result);
     }
+    free(local_X);
+    free(local_Y);
     MPI_Finalize();
     return 0;
 }
@@ -0,0 +1,551 @@
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define MASTER 0
+#define ITERATIONS 100      // Default number of timed SpMV products
+#define GRID_SIZE 512       // Default side of the generated 2D Laplacian (GRID_SIZE^2 rows)
+#define LINE_LENGTH 1024
+
+// Sparse matrix in compressed sparse row (CSR) format
+typedef struct {
+    int rows;
+    int *row_ptr;           // rows + 1 offsets into col and val
+    int *col;               // Column indices (local numbering, see DistMatrix)
+    double *val;
+} CSR;
+
+// Matrix entry in coordinate format, as read from a file
+typedef struct {
+    int row, col;
+    double val;
+} Entry;
+
+// Communication plan for the remote entries of x. Each process sends the listed local
+// entries of x to every neighbour and receives its ghost entries into x[local_rows ...].
+typedef struct {
+    int num_send, num_recv;     // Neighbours to send to and receive from
+    int *send_rank, *send_start;    // send_start[k] .. send_start[k + 1] index send_index
+    int *send_index;                // Local indices of x to send
+    int *recv_rank, *recv_start;    // recv_start[k] .. recv_start[k + 1] index the ghosts
+    double *send_buffer;
+    MPI_Request *requests;
+} HaloPlan;
+
+// Row-partitioned distributed matrix. Process p owns rows [row0, row0 + local_rows) and the
+// same entries of x and y. Columns are renumbered: a local column c is c - row0, a remote
+// column is local_rows + its position in ghost (sorted global indices).
+typedef struct {
+    int n;                  // Global number of rows and columns
+    int row0, local_rows;
+    int num_ghosts;
+    int *ghost;             // Global indices of the remote columns
+    CSR local;              // Entries in locally owned columns
+    CSR remote;             // Entries in remote columns
+    HaloPlan plan;
+    long long nnz;          // Local non-zeros
+    MPI_Comm comm;
+    int rank, size;
+} DistMatrix;
+
+// Function to split n rows into p nearly equal blocks; block r gets [*start, *start + *count)
+void block_range(int n, int p, int r, int *start, int *count) {
+    int base = n / p;
+    int remainder = n % p;
+    *count = base + (r < remainder ? 1 : 0);
+    *start = r * base + (r < remainder ? r : remainder);
+}
+
+// Function to find the process that owns global row i
+int row_owner(int n, int p, int i) {
+    int base = n / p;
+    int remainder = n % p;
+    int split = remainder * (base + 1);
+    return i < split ? i / (base + 1) : remainder + (i - split) / base;
+}
+
+void *checked_malloc(size_t bytes) {
+    void *ptr = malloc(bytes > 0 ? bytes : 1);
+    if (ptr == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    return ptr;
+}
+
+// Function to append an entry to a growing array of entries
+void push_entry(Entry **entries, long long *count, long long *capacity, int row, int col, double val) {
+    if (*count == *capacity) {
+        *capacity = *capacity > 0 ? 2 * *capacity : 1024;
+        *entries = (Entry*)realloc(*entries, *capacity * sizeof(Entry));
+        if (*entries == NULL) {
+            fprintf(stderr, "Memory allocation failed\n");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
+    (*entries)[*count].row = row;
+    (*entries)[*count].col = col;
+    (*entries)[*count].val = val;
+    (*count)++;
+}
+
+// Function to read the entries of rows [row0, row0 + rows) from a Matrix Market coordinate
+// file (real, integer or pattern; general or symmetric). Every process scans the file and
+// keeps only its own rows, so no process ever holds the whole matrix.
+// Returns 0 on success and sets *n to the matrix size.
+int read_matrix_market(const char *filename, int rank, int size, int *n,
+                       Entry **entries, long long *count) {
+    char line[LINE_LENGTH], object[64], format[64], field[64], symmetry[64];
+    long long capacity = 0, nnz;
+    long long line_number = 1;
+    int rows, cols;
+
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+        if (rank == MASTER) printf("Error opening %s\n", filename);
+        return 1;
+    }
+    if (fgets(line, sizeof(line), fp) == NULL ||
+        sscanf(line, "%%%%MatrixMarket %63s %63s %63s %63s", object, format, field, symmetry) != 4 ||
+        strcmp(object, "matrix") != 0 || strcmp(format, "coordinate") != 0 ||
+        strcmp(field, "complex") == 0) {
+        if (rank == MASTER) printf("%s is not a real Matrix Market coordinate file\n", filename);
+        fclose(fp);
+        return 1;
+    }
+    int pattern = strcmp(field, "pattern") == 0;
+    int symmetric = strcmp(symmetry, "general") != 0;
+
+    // Skip comments up to the size line
+    do {
+        if (fgets(line, sizeof(line), fp) == NULL) {
+            fclose(fp);
+            return 1;
+        }
+        line_number++;
+    } while (line[0] == '%');
+    if (sscanf(line, "%d %d %lld", &rows, &cols, &nnz) != 3 || rows != cols) {
+        if (rank == MASTER) printf("%s: only square matrices are supported\n", filename);
+        fclose(fp);
+        return 1;
+    }
+
+    int row0, local_rows;
+    block_range(rows, size, rank, &row0, &local_rows);
+    *entries = NULL;
+    *count = 0;
+    for (long long k = 0; k < nnz; k++) {
+        int i, j;
+        double v = 1.0;
+        if (fgets(line, sizeof(line), fp) == NULL ||
+            sscanf(line, "%d %d %lf", &i, &j, &v) < (pattern ? 2 : 3)) {
+            if (rank == MASTER) printf("%s: truncated after %lld entries\n", filename, k);
+            fclose(fp);
+            return 1;
+        }
+        line_number++;
+        // Every process reads every line, so all of them reject the same entry
+        if (i < 1 || i > rows || j < 1 || j > cols) {
+            if (rank == MASTER)
+                printf("%s:%lld: entry (%d, %d) is outside the %d x %d matrix\n",
+                       filename, line_number, i, j, rows, cols);
+            free(*entries);
+            *entries = NULL;
+            fclose(fp);
+            return 1;
+        }
+        i--;    // Matrix Market indices are 1-based
+        j--;
+        if (i >= row0 && i < row0 + local_rows) push_entry(entries, count, &capacity, i, j, v);
+        // Symmetric files only store the lower triangle
+        if (symmetric && i != j && j >= row0 && j < row0 + local_rows) {
+            push_entry(entries, count, &capacity, j, i, strcmp(symmetry, "skew-symmetric") == 0 ? -v : v);
+        }
+    }
+    fclose(fp);
+    *n = rows;
+    return 0;
+}
+
+// Function to generate the local rows of the 5-point Laplacian on a grid x grid mesh
+void generate_laplacian(int grid, int rank, int size, int *n, Entry **entries, long long *count) {
+    long long capacity = 0;
+    int row0, local_rows;
+
+    *n = grid * grid;
+    block_range(*n, size, rank, &row0, &local_rows);
+    *entries = NULL;
+    *count = 0;
+    for (int r = row0; r < row0 + local_rows; r++) {
+        int i = r / grid, j = r % grid;
+        if (i > 0) push_entry(entries, count, &capacity, r, r - grid, -1.0);
+        if (j > 0) push_entry(entries, count, &capacity, r, r - 1, -1.0);
+        push_entry(entries, count, &capacity, r, r, 4.0);
+        if (j < grid - 1) push_entry(entries, count, &capacity, r, r + 1, -1.0);
+        if (i < grid - 1) push_entry(entries, count, &capacity, r, r + grid, -1.0);
+    }
+}
+
+int compare_int(const void *a, const void *b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+// Function to find the position of value in a sorted array (it must be present)
+int find_sorted(const int *array, int count, int value) {
+    int lo = 0, hi = count - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (array[mid] < value) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Function to build a CSR matrix of the given rows from entries already renumbered to local
+// rows and columns; keep selects the entries that belong to it
+void build_csr(CSR *m, int rows, const Entry *entries, long long count, const int *keep) {
+    m->rows = rows;
+    m->row_ptr = (int*)checked_malloc((rows + 1) * sizeof(int));
+    memset(m->row_ptr, 0, (rows + 1) * sizeof(int));
+    for (long long k = 0; k < count; k++)
+        if (keep[k]) m->row_ptr[entries[k].row + 1]++;
+    for (int i = 0; i < rows; i++)
+        m->row_ptr[i + 1] += m->row_ptr[i];
+
+    int nnz = m->row_ptr[rows];
+    int *next = (int*)checked_malloc(rows * sizeof(int));
+    memcpy(next, m->row_ptr, rows * sizeof(int));
+    m->col = (int*)checked_malloc(nnz * sizeof(int));
+    m->val = (double*)checked_malloc(nnz * sizeof(double));
+    for (long long k = 0; k < count; k++) {
+        if (!keep[k]) continue;
+        int p = next[entries[k].row]++;
+        m->col[p] = entries[k].col;
+        m->val[p] = entries[k].val;
+    }
+    free(next);
+
+    // Order each row by column so x is read in increasing address order
+    for (int i = 0; i < rows; i++) {
+        for (int p = m->row_ptr[i] + 1; p < m->row_ptr[i + 1]; p++) {
+            int c = m->col[p];
+            double v = m->val[p];
+            int q = p - 1;
+            while (q >= m->row_ptr[i] && m->col[q] > c) {
+                m->col[q + 1] = m->col[q];
+                m->val[q + 1] = m->val[q];
+                q--;
+            }
+            m->col[q + 1] = c;
+            m->val[q + 1] = v;
+        }
+    }
+}
+
+// Function to build the halo plan: every process tells the owner of each of its ghost columns
+// which entries of x it needs, once, with MPI_Alltoall and MPI_Alltoallv
+void build_plan(DistMatrix *A) {
+    HaloPlan *plan = &A->plan;
+    int size = A->size;
+    int *recv_counts = (int*)checked_malloc(size * sizeof(int));
+    int *send_counts = (int*)checked_malloc(size * sizeof(int));
+    int *recv_displs = (int*)checked_malloc(size * sizeof(int));
+    int *send_displs = (int*)checked_malloc(size * sizeof(int));
+
+    // Ghosts are sorted, so the ghosts of each owner are contiguous
+    memset(recv_counts, 0, size * sizeof(int));
+    for (int g = 0; g < A->num_ghosts; g++)
+        recv_counts[row_owner(A->n, size, A->ghost[g])]++;
+    MPI_Alltoall(recv_counts, 1, MPI_INT, send_counts, 1, MPI_INT, A->comm);
+
+    int total_send = 0;
+    recv_displs[0] = send_displs[0] = 0;
+    for (int p = 0; p < size; p++) {
+        if (p > 0) {
+            recv_displs[p] = recv_displs[p - 1] + recv_counts[p - 1];
+            send_displs[p] = send_displs[p - 1] + send_counts[p - 1];
+        }
+        total_send += send_counts[p];
+    }
+    int *requested = (int*)checked_malloc(total_send * sizeof(int));
+    MPI_Alltoallv(A->ghost, recv_counts, recv_displs, MPI_INT,
+                  requested, send_counts, send_displs, MPI_INT, A->comm);
+
+    plan->num_send = plan->num_recv = 0;
+    plan->send_rank = (int*)checked_malloc(size * sizeof(int));
+    plan->send_start = (int*)checked_malloc((size + 1) * sizeof(int));
+    plan->recv_rank = (int*)checked_malloc(size * sizeof(int));
+    plan->recv_start = (int*)checked_malloc((size + 1) * sizeof(int));
+    plan->send_index = requested;
+    plan->send_start[0] = plan->recv_start[0] = 0;
+    for (int p = 0; p < size; p++) {
+        if (send_counts[p] > 0) {
+            plan->send_rank[plan->num_send] = p;
+            plan->send_start[plan->num_send + 1] = send_displs[p] + send_counts[p];
+            plan->num_send++;
+        }
+        if (recv_counts[p] > 0) {
+            plan->recv_rank[plan->num_recv] = p;
+            plan->recv_start[plan->num_recv + 1] = recv_displs[p] + recv_counts[p];
+            plan->num_recv++;
+        }
+    }
+    for (int k = 0; k < total_send; k++)
+        requested[k] -= A->row0;    // Global to local index
+    plan->send_buffer = (double*)checked_malloc(total_send * sizeof(double));
+    plan->requests = (MPI_Request*)checked_malloc((plan->num_send + plan->num_recv) * sizeof(MPI_Request));
+
+    free(recv_counts);
+    free(send_counts);
+    free(recv_displs);
+    free(send_displs);
+}
+
+// Function to build the distributed matrix from the entries of the local rows
+void build_matrix(DistMatrix *A, int n, Entry *entries, long long count, MPI_Comm comm) {
+    A->n = n;
+    A->comm = comm;
+    MPI_Comm_rank(comm, &A->rank);
+    MPI_Comm_size(comm, &A->size);
+    block_range(n, A->size, A->rank, &A->row0, &A->local_rows);
+    A->nnz = count;
+
+    // Collect the distinct remote columns
+    int *cols = (int*)checked_malloc(count * sizeof(int));
+    int num_remote = 0;
+    for (long long k = 0; k < count; k++) {
+        int c = entries[k].col;
+        if (c < A->row0 || c >= A->row0 + A->local_rows) cols[num_remote++] = c;
+    }
+    qsort(cols, num_remote, sizeof(int), compare_int);
+    A->num_ghosts = 0;
+    for (int k = 0; k < num_remote; k++)
+        if (k == 0 || cols[k] != cols[k - 1]) cols[A->num_ghosts++] = cols[k];
+    A->ghost = cols;
+
+    // Renumber rows and columns and split the entries into the local and remote parts
+    int *is_local = (int*)checked_malloc(count * sizeof(int));
+    int *is_remote = (int*)checked_malloc(count * sizeof(int));
+    for (long long k = 0; k < count; k++) {
+        int c = entries[k].col;
+        entries[k].row -= A->row0;
+        is_local[k] = c >= A->row0 && c < A->row0 + A->local_rows;
+        is_remote[k] = !is_local[k];
+        entries[k].col = is_local[k] ? c - A->row0
+                                     : A->local_rows + find_sorted(A->ghost, A->num_ghosts, c);
+    }
+    build_csr(&A->local, A->local_rows, entries, count, is_local);
+    build_csr(&A->remote, A->local_rows, entries, count, is_remote);
+    free(is_local);
+    free(is_remote);
+
+    build_plan(A);
+}
+
+void free_csr(CSR *m) {
+    free(m->row_ptr);
+    free(m->col);
+    free(m->val);
+}
+
+void free_matrix(DistMatrix *A) {
+    free_csr(&A->local);
+    free_csr(&A->remote);
+    free(A->ghost);
+    free(A->plan.send_rank);
+    free(A->plan.send_start);
+    free(A->plan.send_index);
+    free(A->plan.recv_rank);
+    free(A->plan.recv_start);
+    free(A->plan.send_buffer);
+    free(A->plan.requests);
+}
+
+// Function to compute y (+)= M x for one CSR part; accumulate adds to y instead of overwriting
+void csr_multiply(const CSR *m, const double *x, double *y, int accumulate) {
+    for (int i = 0; i < m->rows; i++) {
+        double sum = accumulate ? y[i] : 0.0;
+        for (int p = m->row_ptr[i]; p < m->row_ptr[i + 1]; p++)
+            sum += m->val[p] * x[m->col[p]];
+        y[i] = sum;
+    }
+}
+
+// Function to compute y = A x. x holds local_rows owned entries followed by room for the
+// ghosts; the ghost exchange is in flight while the local part is multiplied.
+void spmv(DistMatrix *A, double *x, double *y) {
+    HaloPlan *plan = &A->plan;
+    int count = 0;
+
+    for (int k = 0; k < plan->num_recv; k++) {
+        int start = plan->recv_start[k];
+        MPI_Irecv(x + A->local_rows + start, plan->recv_start[k + 1] - start, MPI_DOUBLE,
+                  plan->recv_rank[k], 0, A->comm, &plan->requests[count++]);
+    }
+    for (int k = 0; k < plan->num_send; k++) {
+        for (int s = plan->send_start[k]; s < plan->send_start[k + 1]; s++)
+            plan->send_buffer[s] = x[plan->send_index[s]];
+        MPI_Isend(plan->send_buffer + plan->send_start[k], plan->send_start[k + 1] - plan->send_start[k],
+                  MPI_DOUBLE, plan->send_rank[k], 0, A->comm, &plan->requests[count++]);
+    }
+
+    csr_multiply(&A->local, x, y, 0);
+    MPI_Waitall(count, plan->requests, MPI_STATUSES_IGNORE);
+    csr_multiply(&A->remote, x, y, 1);
+}
+
+// Function to check y = A x against a product computed straight from the original entries of
+// the local rows (global row and column indices), with all of x gathered on every process by
+// MPI_Allgatherv; neither the local/remote split, the renumbering nor the halo plan is used.
+// Returns the global maximum difference relative to the sum of |a_ij x_j| over the row, which
+// bounds the rounding error of either summation order; a NaN counts as an infinite difference.
+double verify_spmv(const DistMatrix *A, const Entry *entries, long long count, const double *x,
+                   const double *y) {
+    int size = A->size;
+    int *counts = (int*)checked_malloc(size * sizeof(int));
+    int *displs = (int*)checked_malloc(size * sizeof(int));
+    double *full = (double*)checked_malloc((size_t)A->n * sizeof(double));
+    double *reference = (double*)checked_malloc((size_t)A->local_rows * sizeof(double));
+    double *scale = (double*)checked_malloc((size_t)A->local_rows * sizeof(double));
+    double local_max = 0.0, global_max;
+
+    for (int p = 0; p < size; p++)
+        block_range(A->n, size, p, &displs[p], &counts[p]);
+    MPI_Allgatherv(x, A->local_rows, MPI_DOUBLE, full, counts, displs, MPI_DOUBLE, A->comm);
+
+    memset(reference, 0, (size_t)A->local_rows * sizeof(double));
+    memset(scale, 0, (size_t)A->local_rows * sizeof(double));
+    for (long long k = 0; k < count; k++) {
+        double product = entries[k].val * full[entries[k].col];
+        reference[entries[k].row - A->row0] += product;
+        scale[entries[k].row - A->row0] += fabs(product);
+    }
+    for (int i = 0; i < A->local_rows; i++) {
+        double diff = fabs(reference[i] - y[i]) / (scale[i] > 0.0 ? scale[i] : 1.0);
+        if (isnan(diff)) diff = HUGE_VAL;
+        if (diff > local_max) local_max = diff;
+    }
+    MPI_Allreduce(&local_max, &global_max, 1, MPI_DOUBLE, MPI_MAX, A->comm);
+
+    free(counts);
+    free(displs);
+    free(full);
+    free(reference);
+    free(scale);
+    return global_max;
+}
+
+int main(int argc, char *argv[]) {
+    int rank, size, n;
+    int iterations = ITERATIONS, grid = GRID_SIZE;
+    const char *filename = NULL;
+    int bad = 0;
+    Entry *entries = NULL;
+    long long count;
+    DistMatrix A;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--grid") == 0 && i + 1 < argc) {
+            grid = atoi(argv[++i]);
+        } else if (argv[i][0] != '-' && filename == NULL) {
+            filename = argv[i];
+        } else {
+            bad = 1;
+        }
+    }
+    if (bad || iterations < 1 || grid < 1) {
+        if (rank == MASTER) printf("Usage: %s [matrix.mtx] [--grid G] [--iterations K]\n", argv[0]);
+        MPI_Finalize();
+        return 1;
+    }
+
+    // Read or generate the local rows
+    double start_time = MPI_Wtime();
+    if (filename != NULL) {
+        // Agree on failure so that every process exits cleanly and the message is not lost
+        int failed = read_matrix_market(filename, rank, size, &n, &entries, &count) != 0, any_failed;
+        MPI_Allreduce(&failed, &any_failed, 1, MPI_INT, MPI_LOR, MPI_COMM_WORLD);
+        if (any_failed) {
+            free(entries);
+            MPI_Finalize();
+            return 1;
+        }
+    } else {
+        generate_laplacian(grid, rank, size, &n, &entries, &count);
+    }
+    // build_matrix renumbers the entries in place; the check needs them as read
+    Entry *original = (Entry*)checked_malloc(count * sizeof(Entry));
+    memcpy(original, entries, count * sizeof(Entry));
+    build_matrix(&A, n, entries, count, MPI_COMM_WORLD);
+    free(entries);
+    double setup_time = MPI_Wtime() - start_time;
+
+    double *x = (double*)checked_malloc((size_t)(A.local_rows + A.num_ghosts) * sizeof(double));
+    double *y = (double*)checked_malloc((size_t)A.local_rows * sizeof(double));
+    for (int i = 0; i < A.local_rows; i++)
+        x[i] = 1.0 + (A.row0 + i) % 7;
+
+    // One untimed product warms up the caches and the connections
+    spmv(&A, x, y);
+    MPI_Barrier(MPI_COMM_WORLD);
+    start_time = MPI_Wtime();
+    for (int k = 0; k < iterations; k++)
+        spmv(&A, x, y);
+    double run_time = MPI_Wtime() - start_time;
+
+    double error = verify_spmv(&A, original, count, x, y);
+    free(original);
+
+    // Per-process statistics: rows, non-zeros, neighbours, bytes sent and received per SpMV,
+    // matrix and vector bytes streamed per SpMV, and GFLOP/s
+    int sent = A.plan.send_start[A.plan.num_send];
+    double stats[7];
+    stats[0] = A.local_rows;
+    stats[1] = (double)A.nnz;
+    stats[2] = A.plan.num_send > A.plan.num_recv ? A.plan.num_send : A.plan.num_recv;
+    stats[3] = 8.0 * (sent + A.num_ghosts);
+    stats[4] = 12.0 * A.nnz + 8.0 * (2 * A.local_rows + A.num_ghosts) + 8.0 * A.local_rows;
+    stats[5] = 2.0 * A.nnz * iterations / run_time / 1e9;
+    stats[6] = run_time;
+    double *all = NULL;
+    if (rank == MASTER) all = (double*)checked_malloc(7 * (size_t)size * sizeof(double));
+    MPI_Gather(stats, 7, MPI_DOUBLE, all, 7, MPI_DOUBLE, MASTER, MPI_COMM_WORLD);
+
+    if (rank == MASTER) {
+        long long total_nnz = 0;
+        double total_halo = 0.0, max_time = 0.0;
+        printf("Matrix: %s, %d x %d\n", filename != NULL ? filename : "2D Laplacian", n, n);
+        printf("Setup time: %.3f seconds\n", setup_time);
+        printf("%6s %10s %12s %6s %14s %14s %8s\n",
+               "Rank", "Rows", "Nonzeros", "Neigh", "Halo bytes", "Memory bytes", "GFLOP/s");
+        for (int p = 0; p < size; p++) {
+            double *s = all + 7 * p;
+            printf("%6d %10.0f %12.0f %6.0f %14.0f %14.0f %8.3f\n",
+                   p, s[0], s[1], s[2], s[3], s[4], s[5]);
+            total_nnz += (long long)s[1];
+            total_halo += s[3];
+            if (s[6] > max_time) max_time = s[6];
+        }
+        printf("Total non-zeros: %lld, halo traffic per SpMV: %.0f bytes\n", total_nnz, total_halo / 2);
+        printf("SpMV time: %.6f seconds per product (%d products)\n", max_time / iterations, iterations);
+        printf("Performance: %.3f GFLOP/s overall\n", 2.0 * total_nnz * iterations / max_time / 1e9);
+        printf("Verification against the unsplit entries: maximum relative difference %.3e\n", error);
+        printf("Verification: %s\n", error < 1e-10 ? "PASSED" : "FAILED");
+        free(all);
+    }
+
+    free(x);
+    free(y);
+    free_matrix(&A);
+    MPI_Finalize();
+    return 0;
+}
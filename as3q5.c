@@ -0,0 +1,435 @@
+#define _FILE_OFFSET_BITS 64
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <aio.h>
+#include <sys/stat.h>
+#include "sort_engine.h"
+
+#define MEMORY_MB 256           // Default memory budget for all key buffers
+#define MIN_BLOCK 16384         // Smallest merge I/O block in keys (64 KB)
+#define GENERATE_BLOCK 1048576  // Keys per write when generating an input file
+
+// Sorted run: a range of keys in a run file
+typedef struct {
+    off_t offset;               // Byte offset of the first key
+    long length;                // Number of keys
+} Run;
+
+// Double-buffered reader of one run. While the merge consumes buf[cur], the next block is
+// read into the other buffer.
+typedef struct {
+    int fd;
+    off_t offset;               // Next byte to request
+    long left;                  // Keys not yet requested
+    int *buf[2];
+    long len[2], next_len;
+    int cur, pending, done;
+    long pos;
+    int key;                    // buf[cur][pos], the run's smallest unmerged key
+    struct aiocb cb;
+} RunReader;
+
+// Double-buffered writer: one buffer fills while the other is written
+typedef struct {
+    int fd;
+    off_t offset;
+    int *buf[2];
+    long len, block;
+    int cur, pending;
+    struct aiocb cb;
+} RunWriter;
+
+// Statistics of one sort
+typedef struct {
+    double run_time, merge_time;
+    int merge_passes;
+    unsigned long long checksum;    // Order-independent hash of the input keys
+} SortStats;
+
+double wall_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void fail(const char *what, const char *name) {
+    fprintf(stderr, "%s %s: %s\n", what, name, strerror(errno));
+    exit(1);
+}
+
+void *checked_malloc(size_t bytes) {
+    void *ptr = malloc(bytes > 0 ? bytes : 1);
+    if (ptr == NULL) {
+        fprintf(stderr, "Memory allocation failed (%zu bytes)\n", bytes);
+        exit(1);
+    }
+    return ptr;
+}
+
+unsigned long long mix(unsigned long long z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Function to add the keys to an order-independent checksum of the data
+unsigned long long checksum_keys(const int *a, long n, unsigned long long sum) {
+    for (long i = 0; i < n; i++) sum += mix((unsigned int)a[i]);
+    return sum;
+}
+
+// Function to start an asynchronous read or write of bytes at offset
+void start_io(struct aiocb *cb, int fd, void *buf, size_t bytes, off_t offset, int write) {
+    memset(cb, 0, sizeof(*cb));
+    cb->aio_fildes = fd;
+    cb->aio_buf = buf;
+    cb->aio_nbytes = bytes;
+    cb->aio_offset = offset;
+    if ((write ? aio_write(cb) : aio_read(cb)) != 0) fail("Cannot start I/O on", "file");
+}
+
+// Function to wait for an asynchronous transfer; a short transfer is completed synchronously
+void finish_io(struct aiocb *cb, int write) {
+    const struct aiocb *list[1] = {cb};
+    while (aio_error(cb) == EINPROGRESS) aio_suspend(list, 1, NULL);
+    errno = aio_error(cb);
+    ssize_t done = aio_return(cb);
+    if (done < 0) fail("I/O error on", "file");
+
+    char *buf = (char*)cb->aio_buf;
+    while ((size_t)done < cb->aio_nbytes) {
+        ssize_t more = write ? pwrite(cb->aio_fildes, buf + done, cb->aio_nbytes - done, cb->aio_offset + done)
+                             : pread(cb->aio_fildes, buf + done, cb->aio_nbytes - done, cb->aio_offset + done);
+        if (more <= 0) fail("Short transfer on", "file");
+        done += more;
+    }
+}
+
+// Function to request the block after the current one of a run reader
+void reader_prefetch(RunReader *r, long block) {
+    if (r->left == 0) {
+        r->pending = 0;
+        return;
+    }
+    r->next_len = r->left < block ? r->left : block;
+    start_io(&r->cb, r->fd, r->buf[!r->cur], r->next_len * sizeof(int), r->offset, 0);
+    r->offset += r->next_len * sizeof(int);
+    r->left -= r->next_len;
+    r->pending = 1;
+}
+
+// Function to switch a reader to its prefetched block and request the next one
+void reader_next_block(RunReader *r, long block) {
+    if (!r->pending) {
+        r->done = 1;
+        return;
+    }
+    finish_io(&r->cb, 0);
+    r->cur = !r->cur;
+    r->len[r->cur] = r->next_len;
+    r->pos = 0;
+    r->key = r->buf[r->cur][0];
+    reader_prefetch(r, block);
+}
+
+void reader_open(RunReader *r, int fd, Run run, int *memory, long block) {
+    r->fd = fd;
+    r->offset = run.offset;
+    r->left = run.length;
+    r->buf[0] = memory;
+    r->buf[1] = memory + block;
+    r->cur = 1;
+    r->done = 0;
+    reader_prefetch(r, block);
+    reader_next_block(r, block);
+}
+
+void writer_open(RunWriter *w, int fd, off_t offset, int *memory, long block) {
+    w->fd = fd;
+    w->offset = offset;
+    w->buf[0] = memory;
+    w->buf[1] = memory + block;
+    w->block = block;
+    w->len = 0;
+    w->cur = 0;
+    w->pending = 0;
+}
+
+// Function to write the filled buffer in the background and switch to the other buffer
+void writer_flush(RunWriter *w) {
+    if (w->len == 0) return;
+    if (w->pending) finish_io(&w->cb, 1);
+    start_io(&w->cb, w->fd, w->buf[w->cur], w->len * sizeof(int), w->offset, 1);
+    w->offset += w->len * sizeof(int);
+    w->pending = 1;
+    w->cur = !w->cur;
+    w->len = 0;
+}
+
+void writer_put(RunWriter *w, int key) {
+    w->buf[w->cur][w->len++] = key;
+    if (w->len == w->block) writer_flush(w);
+}
+
+void writer_close(RunWriter *w) {
+    writer_flush(w);
+    if (w->pending) finish_io(&w->cb, 1);
+    w->pending = 0;
+}
+
+// Function to decide whether run a wins against run b in the loser tree; exhausted runs always
+// lose and ties go to the lower run, which keeps the merge stable
+int beats(const RunReader *r, int a, int b) {
+    if (r[b].done) return 1;
+    if (r[a].done) return 0;
+    return r[a].key < r[b].key || (r[a].key == r[b].key && a < b);
+}
+
+// Function to build a loser tree over k runs. Leaf i is node k + i and node p has children
+// 2p and 2p + 1; tree[p] keeps the loser of the match at p and tree[0] the overall winner.
+void build_loser_tree(const RunReader *r, int k, int *tree) {
+    int *winner = (int*)checked_malloc(2 * k * sizeof(int));
+    for (int i = 0; i < k; i++) winner[k + i] = i;
+    for (int p = k - 1; p >= 1; p--) {
+        int a = winner[2 * p], b = winner[2 * p + 1];
+        winner[p] = beats(r, a, b) ? a : b;
+        tree[p] = winner[p] == a ? b : a;
+    }
+    tree[0] = k > 1 ? winner[1] : 0;
+    free(winner);
+}
+
+// Function to merge k sorted runs of one file into a single run written at offset. The memory
+// holds 2 * (k + 1) blocks: two per reader and two for the writer.
+void merge_group(int in, int out, const Run *runs, int k, off_t offset, int *memory, long block) {
+    RunReader *r = (RunReader*)checked_malloc(k * sizeof(RunReader));
+    int *tree = (int*)checked_malloc(k * sizeof(int));
+    RunWriter w;
+
+    for (int i = 0; i < k; i++) reader_open(&r[i], in, runs[i], memory + 2 * i * block, block);
+    writer_open(&w, out, offset, memory + 2 * k * block, block);
+    build_loser_tree(r, k, tree);
+
+    while (!r[tree[0]].done) {
+        int win = tree[0];
+        RunReader *rw = &r[win];
+        writer_put(&w, rw->key);
+        if (++rw->pos == rw->len[rw->cur]) reader_next_block(rw, block);
+        else rw->key = rw->buf[rw->cur][rw->pos];
+
+        // Replay the matches on the path from the winner's leaf to the root
+        for (int p = (k + win) / 2; p >= 1; p /= 2) {
+            if (beats(r, tree[p], win)) {
+                int loser = win;
+                win = tree[p];
+                tree[p] = loser;
+            }
+        }
+        tree[0] = win;
+    }
+    writer_close(&w);
+    free(tree);
+    free(r);
+}
+
+// Function to form the sorted runs: the input is read chunk by chunk, each chunk is sorted in
+// memory and written back at the same offset. Three chunk buffers rotate, so the read of the
+// next chunk and the write of the previous one overlap the sort of the current one.
+long form_runs(int in, int out, long n, long chunk, int *memory, Run *runs, SortStats *stats) {
+    int *buf[3] = {memory, memory + chunk, memory + 2 * chunk};
+    int *tmp = memory + 3 * chunk;
+    struct aiocb read_cb, write_cb[3];
+    int write_pending[3] = {0, 0, 0};
+    long num_runs = (n + chunk - 1) / chunk;
+
+    if (num_runs > 0) start_io(&read_cb, in, buf[0], (n < chunk ? n : chunk) * sizeof(int), 0, 0);
+    for (long r = 0; r < num_runs; r++) {
+        int b = r % 3, next = (r + 1) % 3;
+        long length = n - r * chunk < chunk ? n - r * chunk : chunk;
+        finish_io(&read_cb, 0);
+
+        if (r + 1 < num_runs) {
+            long next_length = n - (r + 1) * chunk < chunk ? n - (r + 1) * chunk : chunk;
+            if (write_pending[next]) finish_io(&write_cb[next], 1);
+            write_pending[next] = 0;
+            start_io(&read_cb, in, buf[next], next_length * sizeof(int), (off_t)(r + 1) * chunk * sizeof(int), 0);
+        }
+
+        stats->checksum = checksum_keys(buf[b], length, stats->checksum);
+        radix_sort(buf[b], length, tmp);
+        runs[r].offset = (off_t)r * chunk * sizeof(int);
+        runs[r].length = length;
+        start_io(&write_cb[b], out, buf[b], length * sizeof(int), runs[r].offset, 1);
+        write_pending[b] = 1;
+    }
+    for (int b = 0; b < 3; b++) {
+        if (write_pending[b]) finish_io(&write_cb[b], 1);
+    }
+    return num_runs;
+}
+
+// Function to sort the keys of input into output within memory_keys keys of buffer space
+void external_sort(const char *input, const char *output, long memory_keys, SortStats *stats) {
+    char scratch_name[2][4096];
+    int in = open(input, O_RDONLY);
+    if (in < 0) fail("Cannot open", input);
+    struct stat st;
+    fstat(in, &st);
+    long n = st.st_size / sizeof(int);
+
+    int *memory = (int*)checked_malloc(memory_keys * sizeof(int));
+    long chunk = memory_keys / 4;
+    long num_runs = (n + chunk - 1) / chunk;
+    Run *runs = (Run*)checked_malloc((num_runs > 0 ? num_runs : 1) * sizeof(Run));
+
+    // Widest merge whose blocks are still at least MIN_BLOCK keys
+    long fan_in = memory_keys / (2 * MIN_BLOCK) - 1;
+    if (fan_in > num_runs) fan_in = num_runs;
+    if (fan_in < 2) fan_in = 2;
+    long block = memory_keys / (2 * (fan_in + 1));
+
+    int out = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) fail("Cannot create", output);
+    int scratch[2] = {-1, -1};
+    for (int s = 0; s < 2 && num_runs > 1; s++) {
+        snprintf(scratch_name[s], sizeof(scratch_name[s]), "%s.run%d", output, s);
+        scratch[s] = open(scratch_name[s], O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (scratch[s] < 0) fail("Cannot create", scratch_name[s]);
+    }
+
+    // A single run is written straight to the output
+    double start = wall_time();
+    num_runs = form_runs(in, num_runs > 1 ? scratch[0] : out, n, chunk, memory, runs, stats);
+    stats->run_time = wall_time() - start;
+    printf("Run formation: %ld runs of up to %ld keys in %.3f s (%.1f MB/s read+write)\n",
+           num_runs, chunk, stats->run_time, 2.0 * n * sizeof(int) / stats->run_time / 1e6);
+
+    start = wall_time();
+    int src = 0;
+    while (num_runs > 1) {
+        int last = num_runs <= fan_in;
+        int dst_fd = last ? out : scratch[!src];
+        long merged = 0;
+        double pass_start = wall_time();
+
+        for (long g = 0; g < num_runs; g += fan_in) {
+            int k = num_runs - g < fan_in ? num_runs - g : fan_in;
+            Run combined = {runs[g].offset, 0};
+            for (int i = 0; i < k; i++) combined.length += runs[g + i].length;
+            merge_group(scratch[src], dst_fd, runs + g, k, combined.offset, memory, block);
+            runs[merged++] = combined;
+        }
+        stats->merge_passes++;
+        double pass_time = wall_time() - pass_start;
+        printf("Merge pass %d: %ld runs -> %ld (fan-in %ld, %ld-key blocks) in %.3f s (%.1f MB/s read+write)\n",
+               stats->merge_passes, num_runs, merged, fan_in, block, pass_time,
+               2.0 * n * sizeof(int) / pass_time / 1e6);
+        num_runs = merged;
+        src = !src;
+    }
+    stats->merge_time = wall_time() - start;
+
+    for (int s = 0; s < 2; s++) {
+        if (scratch[s] >= 0) {
+            close(scratch[s]);
+            unlink(scratch_name[s]);
+        }
+    }
+    if (close(out) != 0) fail("Cannot write", output);
+    close(in);
+    free(runs);
+    free(memory);
+}
+
+// Function to write n random keys to a file
+void generate_input(const char *name, long n, unsigned long long seed) {
+    FILE *fp = fopen(name, "wb");
+    if (fp == NULL) fail("Cannot create", name);
+    int *block = (int*)checked_malloc(GENERATE_BLOCK * sizeof(int));
+    for (long i0 = 0; i0 < n; i0 += GENERATE_BLOCK) {
+        long count = n - i0 < GENERATE_BLOCK ? n - i0 : GENERATE_BLOCK;
+        for (long i = 0; i < count; i++) block[i] = (int)mix(seed + (unsigned long long)(i0 + i) * 0x9E3779B97F4A7C15ULL);
+        if (fwrite(block, sizeof(int), count, fp) != (size_t)count) fail("Cannot write", name);
+    }
+    if (fclose(fp) != 0) fail("Cannot write", name);
+    free(block);
+}
+
+// Function to check that the output is sorted and holds the same keys as the input
+int verify_output(const char *name, unsigned long long checksum, long expected) {
+    FILE *fp = fopen(name, "rb");
+    if (fp == NULL) fail("Cannot open", name);
+    int *block = (int*)checked_malloc(GENERATE_BLOCK * sizeof(int));
+    unsigned long long sum = 0;
+    long n = 0, disorder = 0;
+    int previous = 0;
+    size_t count;
+
+    while ((count = fread(block, sizeof(int), GENERATE_BLOCK, fp)) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            if (n + (long)i > 0 && block[i] < previous) disorder++;
+            previous = block[i];
+        }
+        sum = checksum_keys(block, count, sum);
+        n += count;
+    }
+    fclose(fp);
+    free(block);
+
+    printf("Verification: %ld keys, %ld out of order, checksum %s\n", n, disorder,
+           sum == checksum ? "matches" : "DIFFERS");
+    return n == expected && disorder == 0 && sum == checksum;
+}
+
+int main(int argc, char** argv) {
+    const char *input = NULL, *output = NULL;
+    long memory_mb = MEMORY_MB, generate = 0;
+    int verify = 0;
+    unsigned long long seed = (unsigned long long)time(NULL);
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--memory") == 0 && i + 1 < argc) memory_mb = atol(argv[++i]);
+        else if (strcmp(argv[i], "--generate") == 0 && i + 1 < argc) generate = (long)strtod(argv[++i], NULL);
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) seed = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--verify") == 0) verify = 1;
+        else if (input == NULL) input = argv[i];
+        else output = argv[i];
+    }
+    long memory_keys = memory_mb * 1048576 / sizeof(int);
+    if (input == NULL || output == NULL || memory_keys < 6 * MIN_BLOCK) {
+        printf("Usage: %s input.bin output.bin [--memory MB] [--generate N] [--seed S] [--verify]\n", argv[0]);
+        printf("Keys are native 32-bit ints; the budget must be at least %ld MB\n",
+               (6L * MIN_BLOCK * sizeof(int) + 1048575) / 1048576);
+        return 1;
+    }
+
+    if (generate > 0) {
+        double start = wall_time();
+        generate_input(input, generate, seed);
+        printf("Generated %ld random keys in %s (%.3f s)\n", generate, input, wall_time() - start);
+    }
+
+    SortStats stats = {0, 0, 0, 0};
+    struct stat st;
+    if (stat(input, &st) != 0) fail("Cannot open", input);
+    long n = st.st_size / sizeof(int);
+    printf("Sorting %ld keys (%.1f MB) with a %ld MB memory budget, %d sort threads\n",
+           n, n * sizeof(int) / 1e6, memory_mb, sort_threads());
+
+    double start = wall_time();
+    external_sort(input, output, memory_keys, &stats);
+    double total = wall_time() - start;
+    // Every pass reads and writes the whole data set once
+    printf("Total: %.3f s, %d merge passes, %.1f MB/s of sorted output, %.1f MB/s of I/O\n",
+           total, stats.merge_passes, n * sizeof(int) / total / 1e6,
+           2.0 * (1 + stats.merge_passes) * n * sizeof(int) / total / 1e6);
+
+    if (verify && !verify_output(output, stats.checksum, n)) return 1;
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sort_engine.h"
+
+#define MIN_N 1000              // First size of the sweep, the array size of the assignment
+#define MAX_N 10000000          // Default largest size of the sweep
+#define PRINT_LIMIT 20          // Arrays up to this size are printed
+
+int compare_int(const void *a, const void *b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+double wall_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void *checked_malloc(size_t bytes) {
+    void *ptr = malloc(bytes > 0 ? bytes : 1);
+    if (ptr == NULL) {
+        fprintf(stderr, "Memory allocation failed (%zu bytes)\n", bytes);
+        exit(1);
+    }
+    return ptr;
+}
+
+// Function to fill the array with keys over the whole int range, the same for every call with one seed
+void fill_random(int *a, long n, unsigned long long seed) {
+    #pragma omp parallel for schedule(static)
+    for (long i = 0; i < n; i++) {
+        // splitmix64 of the index, so the keys do not depend on the thread count
+        unsigned long long z = seed + (unsigned long long)i * 0x9E3779B97F4A7C15ULL;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        a[i] = (int)(unsigned int)(z ^ (z >> 31));
+    }
+}
+
+void print_array(const char *label, const int *a, long n) {
+    printf("%s:", label);
+    for (long i = 0; i < n; i++) printf(" %d", a[i]);
+    printf("\n");
+}
+
+// Function to time one sort of freshly generated keys and check the result against the reference
+double time_sort(const char *name, void (*sort)(int*, long, int*), int *work, int *tmp,
+                 const int *reference, long n, unsigned long long seed, int *ok) {
+    fill_random(work, n, seed);
+    double start = wall_time();
+    sort(work, n, tmp);
+    double elapsed = wall_time() - start;
+
+    if (memcmp(work, reference, n * sizeof(int)) != 0) {
+        printf("  %s produced a wrong order for n = %ld\n", name, n);
+        *ok = 0;
+    }
+    if (n <= PRINT_LIMIT) print_array(name, work, n);
+    return elapsed;
+}
+
+int main(int argc, char** argv) {
+    long max_n = MAX_N;
+    unsigned long long seed = (unsigned long long)time(NULL);
+    int ok = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) seed = strtoull(argv[++i], NULL, 10);
+        else max_n = (long)strtod(argv[i], NULL);
+    }
+    if (max_n < 1) {
+        printf("Usage: %s [max_n] [--seed S]\n", argv[0]);
+        return 1;
+    }
+
+    int *reference = (int*)checked_malloc(max_n * sizeof(int));
+    int *work = (int*)checked_malloc(max_n * sizeof(int));
+    int *tmp = (int*)checked_malloc(max_n * sizeof(int));
+
+    printf("Sorting random int keys with %d threads (seed %llu)\n", sort_threads(), seed);
+    printf("%12s %12s %12s %12s %10s %10s %12s\n", "n", "qsort (s)", "merge (s)", "radix (s)",
+           "merge x", "radix x", "radix Mkey/s");
+
+    for (long n = MIN_N < max_n ? MIN_N : max_n; ; n = n * 10 < max_n ? n * 10 : max_n) {
+        // The serial library sort is the reference order and the baseline of the speedups
+        fill_random(reference, n, seed);
+        if (n <= PRINT_LIMIT) print_array("input", reference, n);
+        double start = wall_time();
+        qsort(reference, n, sizeof(int), compare_int);
+        double qsort_time = wall_time() - start;
+
+        double merge_time = time_sort("merge sort", merge_sort, work, tmp, reference, n, seed, &ok);
+        double radix_time = time_sort("radix sort", radix_sort, work, tmp, reference, n, seed, &ok);
+
+        printf("%12ld %12.6f %12.6f %12.6f %10.2f %10.2f %12.1f\n", n, qsort_time, merge_time,
+               radix_time, qsort_time / merge_time, qsort_time / radix_time, n / radix_time / 1e6);
+        fflush(stdout);
+        if (n == max_n) break;
+    }
+    printf("Verification: %s\n", ok ? "all sorts match qsort" : "FAILED");
+
+    free(reference);
+    free(work);
+    free(tmp);
+    return ok ? 0 : 1;
+}
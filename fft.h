@@ -0,0 +1,304 @@
+#ifndef FFT_H
+#define FFT_H
+
+// One-dimensional transforms in plain C: a mixed-radix complex FFT of any length (radix 4 and
+// 2 butterflies, a generic butterfly for odd radices, and Bluestein's algorithm for lengths
+// with a prime factor above FFT_MAX_RADIX), the FFT of real input computed with a complex FFT
+// of half the length, and the type-I discrete sine transform built on it. Plans are only read
+// during a transform, so threads can share a plan, each with its own work buffer.
+
+#include <complex.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FFT_MAX_RADIX 64            // Lengths with a larger prime factor use Bluestein's algorithm
+#define FFT_MAX_FACTORS 64
+
+typedef struct FftPlan {
+    long n;
+    int factors[2 * FFT_MAX_FACTORS];   // Pairs of a radix and the length that remains after it
+    double complex *twiddle;            // e^(-2 pi i k / n) for k < n
+    long m;                             // Bluestein: power-of-two length >= 2n - 1, or 0
+    double complex *chirp;              // Bluestein: e^(-i pi k^2 / n) for k < n
+    double complex *filter;             // Bluestein: FFT of the conjugate chirp, length m
+    struct FftPlan *sub;                // Bluestein: plan of length m
+} FftPlan;
+
+// Plan of a real-input FFT: a half-length complex FFT for even lengths, a full one otherwise
+typedef struct {
+    long n;
+    FftPlan *complex_plan;
+    double complex *twiddle;            // e^(-2 pi i k / n) for k <= n / 2 (even lengths)
+} RealPlan;
+
+static inline void fft(const FftPlan *p, double complex *data, double complex *work, int inverse);
+
+// Function to get e^(-2 pi i k / n)
+static inline double complex unit_root(long k, long n) {
+    double angle = -2.0 * M_PI * (double)k / (double)n;
+    return cos(angle) + I * sin(angle);
+}
+
+// Function to get the number of complex elements of work buffer a transform of plan p needs
+static inline long fft_work_size(const FftPlan *p) {
+    return p->m > 0 ? 2 * p->m : p->n;
+}
+
+// Function to plan a complex FFT of length n
+static inline FftPlan *fft_plan(long n) {
+    FftPlan *p = (FftPlan*)calloc(1, sizeof(FftPlan));
+    long rest = n;
+    int f = 0;
+
+    p->n = n;
+    p->twiddle = (double complex*)malloc((n > 0 ? n : 1) * sizeof(double complex));
+    for (long k = 0; k < n; k++) p->twiddle[k] = unit_root(k, n);
+
+    // Radix 4 first, then 2, then the odd factors in increasing order
+    while (rest > 1) {
+        long radix;
+        if (rest % 4 == 0) radix = 4;
+        else if (rest % 2 == 0) radix = 2;
+        else {
+            radix = 3;
+            while (rest % radix != 0 && radix * radix <= rest) radix += 2;
+            if (rest % radix != 0) radix = rest;
+        }
+        if (radix > FFT_MAX_RADIX) break;
+        rest /= radix;
+        p->factors[2 * f] = (int)radix;
+        p->factors[2 * f + 1] = (int)rest;
+        f++;
+    }
+
+    if (rest > 1) {
+        // Bluestein: the transform is a convolution with a chirp, done with power-of-two FFTs
+        long m = 1;
+        while (m < 2 * n - 1) m *= 2;
+        p->m = m;
+        p->sub = fft_plan(m);
+        p->chirp = (double complex*)malloc(n * sizeof(double complex));
+        p->filter = (double complex*)calloc(m, sizeof(double complex));
+        for (long k = 0; k < n; k++) {
+            // k^2 mod 2n keeps the angle small and accurate
+            double angle = -M_PI * (double)((k * k) % (2 * n)) / (double)n;
+            p->chirp[k] = cos(angle) + I * sin(angle);
+        }
+        for (long k = 0; k < n; k++) {
+            p->filter[k] = conj(p->chirp[k]);
+            if (k > 0) p->filter[m - k] = conj(p->chirp[k]);
+        }
+        double complex *work = (double complex*)malloc(fft_work_size(p->sub) * sizeof(double complex));
+        fft(p->sub, p->filter, work, 0);
+        free(work);
+    }
+    return p;
+}
+
+static inline void fft_destroy(FftPlan *p) {
+    if (p == NULL) return;
+    fft_destroy(p->sub);
+    free(p->twiddle);
+    free(p->chirp);
+    free(p->filter);
+    free(p);
+}
+
+// Radix-2 butterflies of m pairs; twiddles are taken with stride fstride
+static inline void butterfly2(const FftPlan *p, double complex *out, long fstride, long m) {
+    double complex *out2 = out + m;
+    for (long k = 0; k < m; k++) {
+        double complex t = out2[k] * p->twiddle[k * fstride];
+        out2[k] = out[k] - t;
+        out[k] += t;
+    }
+}
+
+// Radix-4 butterflies of m quadruples
+static inline void butterfly4(const FftPlan *p, double complex *out, long fstride, long m) {
+    for (long k = 0; k < m; k++) {
+        double complex s0 = out[k + m] * p->twiddle[k * fstride];
+        double complex s1 = out[k + 2 * m] * p->twiddle[2 * k * fstride];
+        double complex s2 = out[k + 3 * m] * p->twiddle[3 * k * fstride];
+        double complex s3 = s0 + s2, s4 = s0 - s2, s5 = out[k] - s1;
+        double complex s6 = out[k] + s1;
+        out[k] = s6 + s3;
+        out[k + 2 * m] = s6 - s3;
+        out[k + m] = s5 - I * s4;
+        out[k + 3 * m] = s5 + I * s4;
+    }
+}
+
+// Butterflies of any radix: every output of a group is a direct sum over its radix inputs
+static inline void butterfly_generic(const FftPlan *p, double complex *out, long fstride, long m, int radix) {
+    double complex scratch[FFT_MAX_RADIX];
+    for (long u = 0; u < m; u++) {
+        for (int q = 0; q < radix; q++) scratch[q] = out[u + q * m];
+        for (int q1 = 0; q1 < radix; q1++) {
+            long k = u + q1 * m, index = 0;
+            double complex sum = scratch[0];
+            for (int q = 1; q < radix; q++) {
+                index += fstride * k;
+                if (index >= p->n) index -= p->n;
+                sum += scratch[q] * p->twiddle[index];
+            }
+            out[k] = sum;
+        }
+    }
+}
+
+// Function to compute out[0, n) = FFT of the elements of in at stride fstride * istride by
+// decimation in time: the radix sub-sequences are transformed recursively into consecutive
+// parts of out and combined by one layer of butterflies
+static inline void fft_recursive(const FftPlan *p, double complex *out, const double complex *in, long fstride,
+                                 long istride, const int *factors) {
+    int radix = factors[0];
+    long m = factors[1];
+
+    if (m == 1) {
+        for (int q = 0; q < radix; q++) out[q] = in[q * fstride * istride];
+    } else {
+        for (int q = 0; q < radix; q++)
+            fft_recursive(p, out + q * m, in + q * fstride * istride, fstride * radix, istride, factors + 2);
+    }
+    if (radix == 2) butterfly2(p, out, fstride, m);
+    else if (radix == 4) butterfly4(p, out, fstride, m);
+    else butterfly_generic(p, out, fstride, m, radix);
+}
+
+// Function to transform data[0, n) in place (unnormalized; the inverse uses e^(+2 pi i k / n),
+// so a forward and an inverse transform multiply by n). work holds fft_work_size(p) elements.
+static inline void fft(const FftPlan *p, double complex *data, double complex *work, int inverse) {
+    long n = p->n;
+    if (n <= 1) return;
+
+    if (p->m > 0) {
+        double complex *a = work, *sub_work = work + p->m;
+        for (long k = 0; k < n; k++) a[k] = (inverse ? conj(data[k]) : data[k]) * p->chirp[k];
+        memset(a + n, 0, (p->m - n) * sizeof(double complex));
+        fft(p->sub, a, sub_work, 0);
+        for (long k = 0; k < p->m; k++) a[k] *= p->filter[k];
+        fft(p->sub, a, sub_work, 1);
+        for (long k = 0; k < n; k++) {
+            double complex x = p->chirp[k] * a[k] / (double)p->m;
+            data[k] = inverse ? conj(x) : x;
+        }
+        return;
+    }
+
+    // The inverse is the conjugate of the forward transform of the conjugate
+    for (long k = 0; k < n; k++) work[k] = inverse ? conj(data[k]) : data[k];
+    fft_recursive(p, data, work, 1, 1, p->factors);
+    if (inverse)
+        for (long k = 0; k < n; k++) data[k] = conj(data[k]);
+}
+
+// Function to plan a real-input FFT of length n
+static inline RealPlan *real_plan(long n) {
+    RealPlan *rp = (RealPlan*)calloc(1, sizeof(RealPlan));
+    rp->n = n;
+    if (n % 2 == 0) {
+        rp->complex_plan = fft_plan(n / 2);
+        rp->twiddle = (double complex*)malloc((n / 2 + 1) * sizeof(double complex));
+        for (long k = 0; k <= n / 2; k++) rp->twiddle[k] = unit_root(k, n);
+    } else {
+        rp->complex_plan = fft_plan(n);
+    }
+    return rp;
+}
+
+static inline void real_destroy(RealPlan *rp) {
+    fft_destroy(rp->complex_plan);
+    free(rp->twiddle);
+    free(rp);
+}
+
+// Function to get the number of complex elements of work buffer a real transform needs
+static inline long real_work_size(const RealPlan *rp) {
+    return rp->complex_plan->n + fft_work_size(rp->complex_plan);
+}
+
+// Function to compute the n / 2 + 1 non-redundant outputs of the FFT of n reals. For even n
+// the even and odd samples are packed as one complex sequence of length n / 2, transformed,
+// and separated again using the symmetry of the transforms of real sequences.
+static inline void fft_r2c(const RealPlan *rp, const double *in, double complex *out, double complex *work) {
+    long n = rp->n, h = n / 2;
+
+    if (n % 2 != 0) {
+        for (long k = 0; k < n; k++) work[k] = in[k];
+        fft(rp->complex_plan, work, work + n, 0);
+        memcpy(out, work, (h + 1) * sizeof(double complex));
+        return;
+    }
+    for (long k = 0; k < h; k++) out[k] = in[2 * k] + I * in[2 * k + 1];
+    fft(rp->complex_plan, out, work, 0);
+
+    double complex z0 = out[0];
+    out[0] = creal(z0) + cimag(z0);
+    out[h] = creal(z0) - cimag(z0);
+    for (long k = 1; 2 * k <= h; k++) {
+        // Outputs k and h - k come from the same pair of packed values
+        double complex zk = out[k], zm = out[h - k];
+        double complex even = 0.5 * (zk + conj(zm)), odd = -0.5 * I * (zk - conj(zm));
+        out[k] = even + rp->twiddle[k] * odd;
+        if (2 * k != h) {
+            double complex even2 = 0.5 * (zm + conj(zk)), odd2 = -0.5 * I * (zm - conj(zk));
+            out[h - k] = even2 + rp->twiddle[h - k] * odd2;
+        }
+    }
+}
+
+// Function to compute n reals from the n / 2 + 1 outputs of a real FFT, unnormalized like
+// the complex inverse (the result is n times the original sequence)
+static inline void fft_c2r(const RealPlan *rp, const double complex *in, double *out, double complex *work) {
+    long n = rp->n, h = n / 2;
+    double complex *z = work;
+
+    if (n % 2 != 0) {
+        z[0] = in[0];
+        for (long k = 1; k <= h; k++) {
+            z[k] = in[k];
+            z[n - k] = conj(in[k]);
+        }
+        fft(rp->complex_plan, z, work + n, 1);
+        for (long k = 0; k < n; k++) out[k] = creal(z[k]);
+        return;
+    }
+    for (long k = 0; k < h; k++) {
+        double complex even = in[k] + conj(in[h - k]);
+        double complex odd = (in[k] - conj(in[h - k])) * conj(rp->twiddle[k]);
+        z[k] = even + I * odd;
+    }
+    fft(rp->complex_plan, z, work + h, 1);
+    for (long k = 0; k < h; k++) {
+        out[2 * k] = creal(z[k]);
+        out[2 * k + 1] = cimag(z[k]);
+    }
+}
+
+// Function to get the number of complex elements of work buffer a sine transform of length n
+// needs, with the real plan rp of length 2 (n + 1)
+static inline long dst_work_size(const RealPlan *rp) {
+    return rp->n / 2 + (rp->n / 2 + 1) + real_work_size(rp);
+}
+
+// Function to compute the type-I discrete sine transform of x[0, n) in place,
+// X[k] = sum of x[j] sin(pi (j + 1) (k + 1) / (n + 1)), with a real FFT of length 2 (n + 1)
+// (rp) of the odd extension 0, x, 0, -reversed x. Applying it twice multiplies by (n + 1) / 2.
+static inline void dst1(const RealPlan *rp, double *x, long n, double complex *work) {
+    double *y = (double*)work;
+    double complex *spectrum = work + (n + 1), *fft_work = spectrum + (n + 2);
+    long m = 2 * (n + 1);
+
+    y[0] = 0.0;
+    y[n + 1] = 0.0;
+    for (long j = 0; j < n; j++) {
+        y[j + 1] = x[j];
+        y[m - 1 - j] = -x[j];
+    }
+    fft_r2c(rp, y, spectrum, fft_work);
+    for (long k = 0; k < n; k++) x[k] = -0.5 * cimag(spectrum[k + 1]);
+}
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef PHILOX_H
+#define PHILOX_H
+
+// Counter-based random numbers (Philox4x32-10, Salmon et al., SC'11). Element i of a stream
+// is a pure function of (seed, stream, i), so every process and thread can fill exactly its
+// own slice of a global sequence without communication, and the sequence does not depend on
+// how it is split. Build with -fopenmp to fill slices with all threads.
+
+#include <stdint.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u       // Key increments (golden ratio, sqrt(3) - 1)
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+// Function to encrypt the 128-bit counter ctr with the 64-bit key into 128 random bits
+static inline void philox4x32(const uint32_t ctr[4], const uint32_t key[2], uint32_t out[4]) {
+    uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int r = 0; r < PHILOX_ROUNDS; r++) {
+        uint64_t p0 = (uint64_t)PHILOX_M0 * c0, p1 = (uint64_t)PHILOX_M1 * c2;
+        uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0, n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        c0 = n0;
+        c1 = (uint32_t)p1;
+        c2 = n2;
+        c3 = (uint32_t)p0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+// Function to get the 64-bit words of elements 2 * block and 2 * block + 1 of a stream
+static inline void random_pair(uint64_t seed, uint64_t stream, uint64_t block, uint64_t pair[2]) {
+    uint32_t ctr[4] = {(uint32_t)block, (uint32_t)(block >> 32), (uint32_t)stream, (uint32_t)(stream >> 32)};
+    uint32_t key[2] = {(uint32_t)seed, (uint32_t)(seed >> 32)};
+    uint32_t out[4];
+    philox4x32(ctr, key, out);
+    pair[0] = (uint64_t)out[0] << 32 | out[1];
+    pair[1] = (uint64_t)out[2] << 32 | out[3];
+}
+
+// Function to get the 64 random bits of element index of a stream
+static inline uint64_t random_u64(uint64_t seed, uint64_t stream, uint64_t index) {
+    uint64_t pair[2];
+    random_pair(seed, stream, index / 2, pair);
+    return pair[index % 2];
+}
+
+// Function to turn 64 random bits into a double in [0, 1) with 53 random bits
+static inline double bits_to_unit(uint64_t x) {
+    return (double)(x >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Function to turn 64 random bits into an integer in [lo, hi] without division
+static inline int bits_to_int(uint64_t x, int lo, int hi) {
+    return lo + (int)(((x >> 32) * ((uint64_t)hi - lo + 1)) >> 32);
+}
+
+// Function to get element index of a stream as a double in [0, 1)
+static inline double random_uniform(uint64_t seed, uint64_t stream, uint64_t index) {
+    return bits_to_unit(random_u64(seed, stream, index));
+}
+
+// Function to fill out[0, count) with elements first .. first + count - 1 of a stream, uniform
+// in [lo, hi). The threads share the pairs of elements that one Philox call produces.
+static inline void fill_uniform(double *out, long count, uint64_t first, double lo, double hi,
+                                uint64_t seed, uint64_t stream) {
+    double scale = hi - lo;
+    long head = (first % 2 == 1 && count > 0) ? 1 : 0;
+    long pairs = (count - head) / 2;
+
+    if (head) out[0] = lo + scale * random_uniform(seed, stream, first);
+    #pragma omp parallel for schedule(static)
+    for (long p = 0; p < pairs; p++) {
+        uint64_t pair[2];
+        random_pair(seed, stream, (first + head) / 2 + p, pair);
+        out[head + 2 * p] = lo + scale * bits_to_unit(pair[0]);
+        out[head + 2 * p + 1] = lo + scale * bits_to_unit(pair[1]);
+    }
+    if (head + 2 * pairs < count)
+        out[count - 1] = lo + scale * random_uniform(seed, stream, first + count - 1);
+}
+
+// Function to fill out[0, count) with elements first .. first + count - 1 of a stream as
+// integers in [lo, hi]
+static inline void fill_int(int *out, long count, uint64_t first, int lo, int hi, uint64_t seed, uint64_t stream) {
+    long head = (first % 2 == 1 && count > 0) ? 1 : 0;
+    long pairs = (count - head) / 2;
+
+    if (head) out[0] = bits_to_int(random_u64(seed, stream, first), lo, hi);
+    #pragma omp parallel for schedule(static)
+    for (long p = 0; p < pairs; p++) {
+        uint64_t pair[2];
+        random_pair(seed, stream, (first + head) / 2 + p, pair);
+        out[head + 2 * p] = bits_to_int(pair[0], lo, hi);
+        out[head + 2 * p + 1] = bits_to_int(pair[1], lo, hi);
+    }
+    if (head + 2 * pairs < count)
+        out[count - 1] = bits_to_int(random_u64(seed, stream, first + count - 1), lo, hi);
+}
+
+#endif
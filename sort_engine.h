@@ -0,0 +1,192 @@
+#ifndef SORT_ENGINE_H
+#define SORT_ENGINE_H
+
+// Shared-memory sort engine for int keys: a task-parallel merge sort whose merges are split
+// among threads by co-ranking, and a parallel LSD radix sort. Both sort a[0, n) in place and
+// need a scratch array tmp of n keys. Without OpenMP everything runs serially.
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define SORT_INSERTION_CUTOFF 32        // Runs this short are sorted by insertion
+#define SORT_TASK_CUTOFF 16384          // Smaller halves are sorted without new tasks
+#define SORT_MERGE_GRAIN 65536          // Output keys per parallel merge segment
+#define RADIX_SERIAL_CUTOFF 65536       // Radix sorts of fewer keys run on one thread
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+
+// Function to get the number of threads available to the sort
+static int sort_threads(void) {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+// Function to sort a short run in place by insertion
+static void insertion_sort(int *a, long n) {
+    for (long i = 1; i < n; i++) {
+        int key = a[i];
+        long j = i - 1;
+        while (j >= 0 && a[j] > key) {
+            a[j + 1] = a[j];
+            j--;
+        }
+        a[j + 1] = key;
+    }
+}
+
+// Function to merge the sorted ranges a[0, na) and b[0, nb) into out; equal keys of a go first
+static void merge_runs(const int *a, long na, const int *b, long nb, int *out) {
+    long i = 0, j = 0, k = 0;
+    while (i < na && j < nb) out[k++] = b[j] < a[i] ? b[j++] : a[i++];
+    memcpy(out + k, a + i, (na - i) * sizeof(int));
+    memcpy(out + k + (na - i), b + j, (nb - j) * sizeof(int));
+}
+
+// Function to co-rank output position k of the merge of a[0, na) and b[0, nb): returns the i
+// such that the first k merged keys are a[0, i) and b[0, k - i), consistent with merge_runs
+static long co_rank(long k, const int *a, long na, const int *b, long nb) {
+    long lo = k > nb ? k - nb : 0;
+    long hi = k < na ? k : na;
+    while (lo < hi) {
+        long i = (lo + hi) / 2;
+        long j = k - i;
+        // a[i] belongs in the first k keys when it does not come after b[j - 1]
+        if (j > 0 && a[i] <= b[j - 1]) lo = i + 1;
+        else hi = i;
+    }
+    return lo;
+}
+
+// Function to merge two sorted ranges with all threads: the output is cut into segments of
+// SORT_MERGE_GRAIN keys, each segment's inputs are found by co-ranking its two ends, and the
+// segments are merged as independent tasks
+static void parallel_merge(const int *a, long na, const int *b, long nb, int *out) {
+    long n = na + nb;
+    if (n <= SORT_MERGE_GRAIN) {
+        merge_runs(a, na, b, nb, out);
+        return;
+    }
+    for (long k0 = 0; k0 < n; k0 += SORT_MERGE_GRAIN) {
+        #pragma omp task firstprivate(k0)
+        {
+            long k1 = k0 + SORT_MERGE_GRAIN < n ? k0 + SORT_MERGE_GRAIN : n;
+            long i0 = co_rank(k0, a, na, b, nb), i1 = co_rank(k1, a, na, b, nb);
+            merge_runs(a + i0, i1 - i0, b + (k0 - i0), (k1 - i1) - (k0 - i0), out + k0);
+        }
+    }
+    #pragma omp taskwait
+}
+
+// Function to sort a[0, n) into dst (which is a itself when to_a is set, otherwise tmp)
+// by recursive merge sort; the halves are sorted as tasks that idle threads pick up
+static void merge_sort_task(int *a, int *tmp, long n, int to_a) {
+    if (n <= SORT_INSERTION_CUTOFF) {
+        insertion_sort(a, n);
+        if (!to_a) memcpy(tmp, a, n * sizeof(int));
+        return;
+    }
+
+    long half = n / 2;
+    // Sort both halves into the other buffer, then merge them back into the target
+    if (n > SORT_TASK_CUTOFF) {
+        #pragma omp task
+        merge_sort_task(a, tmp, half, !to_a);
+        merge_sort_task(a + half, tmp + half, n - half, !to_a);
+        #pragma omp taskwait
+    } else {
+        merge_sort_task(a, tmp, half, !to_a);
+        merge_sort_task(a + half, tmp + half, n - half, !to_a);
+    }
+
+    const int *src = to_a ? tmp : a;
+    int *dst = to_a ? a : tmp;
+    if (n > SORT_TASK_CUTOFF) {
+        parallel_merge(src, half, src + half, n - half, dst);
+    } else {
+        merge_runs(src, half, src + half, n - half, dst);
+    }
+}
+
+// Function to sort n keys with the parallel merge sort; tmp must hold n keys. The sort is stable.
+static void merge_sort(int *a, long n, int *tmp) {
+    #pragma omp parallel
+    #pragma omp single nowait
+    merge_sort_task(a, tmp, n, 1);
+}
+
+// Function to sort n keys with a least-significant-digit radix sort, RADIX_BITS per pass.
+// Each thread counts the digits of its own block, the counts are turned into per-thread
+// output offsets, and every thread scatters its block; passes in which all keys share the
+// digit are skipped. tmp must hold n keys. The sort is stable.
+static void radix_sort(int *a, long n, int *tmp) {
+    int threads = n < RADIX_SERIAL_CUTOFF ? 1 : sort_threads();
+    long *count = (long*)malloc((size_t)threads * RADIX_BUCKETS * sizeof(long));
+    int *src = a, *dst = tmp;
+
+    if (count == NULL) {
+        merge_sort(a, n, tmp);
+        return;
+    }
+    for (int shift = 0; shift < 32; shift += RADIX_BITS) {
+        // Flipping the sign bit orders negative keys first
+        uint32_t flip = shift + RADIX_BITS >= 32 ? 0x80000000u : 0;
+        int skip = 0;
+
+        #pragma omp parallel num_threads(threads)
+        {
+            int t = 0, nt = 1;
+#ifdef _OPENMP
+            t = omp_get_thread_num();
+            nt = omp_get_num_threads();
+#endif
+            long lo = n * t / nt, hi = n * (t + 1) / nt;
+            long *c = count + (size_t)t * RADIX_BUCKETS;
+
+            memset(c, 0, RADIX_BUCKETS * sizeof(long));
+            for (long i = lo; i < hi; i++)
+                c[(((uint32_t)src[i] ^ flip) >> shift) & (RADIX_BUCKETS - 1)]++;
+
+            #pragma omp barrier
+            #pragma omp single
+            {
+                // Bucket b of thread t starts after all smaller buckets and after bucket b
+                // of the threads before t
+                long offset = 0;
+                for (int b = 0; b < RADIX_BUCKETS; b++) {
+                    long total = 0;
+                    for (int u = 0; u < nt; u++) total += count[(size_t)u * RADIX_BUCKETS + b];
+                    if (total == n) skip = 1;
+                    for (int u = 0; u < nt; u++) {
+                        long here = count[(size_t)u * RADIX_BUCKETS + b];
+                        count[(size_t)u * RADIX_BUCKETS + b] = offset;
+                        offset += here;
+                    }
+                }
+            }
+
+            if (!skip) {
+                for (long i = lo; i < hi; i++) {
+                    int key = src[i];
+                    dst[c[(((uint32_t)key ^ flip) >> shift) & (RADIX_BUCKETS - 1)]++] = key;
+                }
+            }
+        }
+
+        if (!skip) {
+            int *t = src;
+            src = dst;
+            dst = t;
+        }
+    }
+    if (src != a) memcpy(a, src, n * sizeof(int));
+    free(count);
+}
+
+#endif